@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q4112_aggr.h"
+
+#define BIG_NUMBER 0x9e3779b1
+/* partitions use a second hash so that a partition still spreads over
+ * the whole private table, which hashes with BIG_NUMBER
+ */
+#define PART_NUMBER 0x85ebca6b
+/* partitions per thread; more than one keeps the merge balanced */
+#define PARTITIONS_PER_THREAD 8
+
+void aggr_table_init(aggr_table_t *aggr, int8_t log_buckets)
+{
+	aggr->log_buckets = log_buckets;
+	aggr->buckets = ((size_t) 1) << log_buckets;
+	aggr->used = 0;
+	aggr->table = (aggr_bucket_t *)
+		calloc(aggr->buckets, sizeof(aggr_bucket_t));
+	assert(aggr->table != NULL);
+}
+
+void aggr_table_free(aggr_table_t *aggr)
+{
+	free(aggr->table);
+	aggr->table = NULL;
+}
+
+static void aggr_table_grow(aggr_table_t *aggr)
+{
+	aggr_table_t bigger;
+	size_t i;
+	aggr_table_init(&bigger, aggr->log_buckets + 1);
+	for (i = 0; i != aggr->buckets; ++i)
+		if (aggr->table[i].aggr_key != 0)
+			aggr_table_update(&bigger, aggr->table[i].aggr_key,
+					  aggr->table[i].count,
+					  aggr_bucket_sum(&aggr->table[i]));
+	free(aggr->table);
+	*aggr = bigger;
+}
+
+void aggr_table_update(aggr_table_t *aggr, uint32_t aggr_key,
+		       uint64_t count_delta, aggr_sum_t sum_delta)
+{
+	uint32_t h = (uint32_t) (aggr_key * BIG_NUMBER);
+	h >>= 32 - aggr->log_buckets;
+	while (aggr->table[h].aggr_key != aggr_key) {
+		if (aggr->table[h].aggr_key == 0) {
+			if ((aggr->used + 1) * 3 > aggr->buckets * 2) {
+				aggr_table_grow(aggr);
+				aggr_table_update(aggr, aggr_key,
+						  count_delta, sum_delta);
+				return;
+			}
+			aggr->table[h].aggr_key = aggr_key;
+			aggr->used++;
+			break;
+		}
+		h = (h + 1) & (aggr->buckets - 1);
+	}
+	aggr->table[h].count += count_delta;
+	aggr_bucket_add_sum(&aggr->table[h], sum_delta);
+}
+
+int aggr_partitioned(void)
+{
+	const char *mode = getenv("Q4112_AGGR");
+	return mode != NULL && strcmp(mode, "partitioned") == 0;
+}
+
+void aggr_exchange_init(aggr_exchange_t *exchange, int threads)
+{
+	exchange->threads = threads;
+	exchange->log_partitions = 0;
+	while ((1 << exchange->log_partitions) <
+	       threads * PARTITIONS_PER_THREAD)
+		exchange->log_partitions++;
+	exchange->partitions = ((size_t) 1) << exchange->log_partitions;
+	size_t all = threads * exchange->partitions;
+	exchange->parts = (aggr_bucket_t **)
+		calloc(all, sizeof(aggr_bucket_t *));
+	exchange->sizes = (size_t *) calloc(all, sizeof(size_t));
+	exchange->caps = (size_t *) calloc(all, sizeof(size_t));
+	assert(exchange->parts != NULL);
+	assert(exchange->sizes != NULL && exchange->caps != NULL);
+	exchange->next_partition = 0;
+}
+
+void aggr_exchange_free(aggr_exchange_t *exchange)
+{
+	size_t i;
+	for (i = 0; i != exchange->threads * exchange->partitions; ++i)
+		free(exchange->parts[i]);
+	free(exchange->parts);
+	free(exchange->sizes);
+	free(exchange->caps);
+}
+
+void aggr_exchange_add(aggr_exchange_t *exchange, int thread,
+		       uint32_t aggr_key, uint64_t count, aggr_sum_t sum)
+{
+	uint32_t h = (uint32_t) (aggr_key * PART_NUMBER);
+	size_t p = thread * exchange->partitions +
+		(h >> (32 - exchange->log_partitions));
+	if (exchange->log_partitions == 0)
+		p = thread;
+	if (exchange->sizes[p] == exchange->caps[p]) {
+		exchange->caps[p] = exchange->caps[p] ?
+			exchange->caps[p] * 2 : 64;
+		exchange->parts[p] = (aggr_bucket_t *)
+			realloc(exchange->parts[p],
+				exchange->caps[p] * sizeof(aggr_bucket_t));
+		assert(exchange->parts[p] != NULL);
+	}
+	aggr_bucket_t *bucket = &exchange->parts[p][exchange->sizes[p]++];
+	bucket->aggr_key = aggr_key;
+	bucket->count = count;
+	aggr_bucket_set_sum(bucket, sum);
+}
+
+void aggr_exchange_merge(aggr_exchange_t *exchange,
+			 aggr_sum_t *sum, uint64_t *count)
+{
+	size_t p, t, i;
+	for (;;) {
+		p = __sync_fetch_and_add(&exchange->next_partition, 1);
+		if (p >= exchange->partitions)
+			break;
+		/* size the private table for all partials of the partition */
+		size_t partials = 0;
+		for (t = 0; t != exchange->threads; ++t)
+			partials += exchange->sizes[t * exchange->partitions + p];
+		if (partials == 0)
+			continue;
+		int8_t log_buckets = 1;
+		while ((((size_t) 1) << log_buckets) * 0.67 < partials)
+			log_buckets++;
+		aggr_table_t aggr;
+		aggr_table_init(&aggr, log_buckets);
+		for (t = 0; t != exchange->threads; ++t) {
+			size_t q = t * exchange->partitions + p;
+			for (i = 0; i != exchange->sizes[q]; ++i)
+				aggr_table_update(&aggr,
+						  exchange->parts[q][i].aggr_key,
+						  exchange->parts[q][i].count,
+						  aggr_bucket_sum(&exchange->parts[q][i]));
+		}
+		for (i = 0; i != aggr.buckets; ++i) {
+			if (aggr.table[i].aggr_key != 0 &&
+			    aggr.table[i].count > 0) {
+				*sum += aggr_bucket_sum(&aggr.table[i]) /
+					aggr.table[i].count;
+				*count += 1;
+			}
+		}
+		aggr_table_free(&aggr);
+	}
+}
@@ -0,0 +1,178 @@
+#ifndef _Q4112_AGGR_
+#define _Q4112_AGGR_
+
+#include <assert.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* group sums are 128-bit: billions of orders of one group pass 2^64 */
+typedef unsigned __int128 aggr_sum_t;
+
+/*
+ * 24 bytes like the bucket with a 64-bit sum: the sum of a bucket keeps
+ * 96 bits, its high word in the padding after the key, which is exact
+ * for 2^32 orders of the largest price * quantity in one group
+ */
+typedef struct {
+	uint32_t aggr_key;
+	uint32_t sum_high;
+	uint64_t sum_low;
+	uint64_t count;
+} aggr_bucket_t;
+
+static inline aggr_sum_t aggr_bucket_sum(const aggr_bucket_t *bucket)
+{
+	return ((aggr_sum_t) bucket->sum_high << 64) | bucket->sum_low;
+}
+
+static inline void aggr_bucket_set_sum(aggr_bucket_t *bucket, aggr_sum_t sum)
+{
+	assert((sum >> 96) == 0);
+	bucket->sum_low = (uint64_t) sum;
+	bucket->sum_high = (uint32_t) (sum >> 64);
+}
+
+/*
+ * an add with carry; the high word must not wrap. Almost every delta is
+ * a single price * quantity that does not carry, so only the low word is
+ * read and written then, as for a plain 64-bit sum
+ */
+static inline void aggr_bucket_add_sum(aggr_bucket_t *bucket, aggr_sum_t delta)
+{
+	uint64_t low = bucket->sum_low + (uint64_t) delta;
+	if (__builtin_expect((delta >> 64) == 0 && low >= (uint64_t) delta, 1)) {
+		bucket->sum_low = low;
+		return;
+	}
+	uint64_t high = bucket->sum_high + (uint64_t) (delta >> 64) +
+		(low < (uint64_t) delta);
+	assert((high >> 32) == 0 && (delta >> 96) == 0);
+	bucket->sum_low = low;
+	bucket->sum_high = (uint32_t) high;
+}
+
+/*
+ * add to the sum of a bucket shared by threads with atomics: the thread
+ * whose add wraps the low word carries into the high word, so the sum is
+ * exact once all adds are done
+ */
+static inline void aggr_bucket_add_sum_atomic(aggr_bucket_t *bucket,
+					      aggr_sum_t delta)
+{
+	uint64_t low = (uint64_t) delta;
+	uint32_t high = (uint32_t) (delta >> 64);
+	assert((delta >> 96) == 0);
+	uint64_t old = __sync_fetch_and_add(&bucket->sum_low, low);
+	high += old + low < old;
+	if (high != 0)
+		__sync_fetch_and_add(&bucket->sum_high, high);
+}
+
+/*
+ * 64-bit SIMD lanes of a sum of products of two 32-bit values: a single
+ * product can be close to 2^64, so every add counts the carry out of its
+ * lane in carry and the lanes are folded into a 128-bit sum at the end
+ */
+__attribute__((target("avx2")))
+static inline __m256i aggr_lanes_add_avx2(__m256i acc, __m256i add,
+					  __m256i *carry)
+{
+	const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+	__m256i sum = _mm256_add_epi64(acc, add);
+	/*the lane wrapped if the sum is below the addend (unsigned)*/
+	__m256i wrap = _mm256_cmpgt_epi64(_mm256_xor_si256(add, sign),
+					  _mm256_xor_si256(sum, sign));
+	*carry = _mm256_sub_epi64(*carry, wrap);
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static inline aggr_sum_t aggr_lanes_sum_avx2(__m256i acc, __m256i carry)
+{
+	uint64_t low[4], high[4];
+	aggr_sum_t sum = 0;
+	int l;
+	_mm256_storeu_si256((__m256i *) low, acc);
+	_mm256_storeu_si256((__m256i *) high, carry);
+	for (l = 0; l != 4; ++l)
+		sum += ((aggr_sum_t) high[l] << 64) + low[l];
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i aggr_lanes_add_avx512(__m512i acc, __m512i add,
+					    __m512i *carry)
+{
+	__m512i sum = _mm512_add_epi64(acc, add);
+	__mmask8 wrap = _mm512_cmplt_epu64_mask(sum, add);
+	*carry = _mm512_mask_add_epi64(*carry, wrap, *carry,
+				       _mm512_set1_epi64(1));
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static inline aggr_sum_t aggr_lanes_sum_avx512(__m512i acc, __m512i carry)
+{
+	uint64_t low[8], high[8];
+	aggr_sum_t sum = 0;
+	int l;
+	_mm512_storeu_si512(low, acc);
+	_mm512_storeu_si512(high, carry);
+	for (l = 0; l != 8; ++l)
+		sum += ((aggr_sum_t) high[l] << 64) + low[l];
+	return sum;
+}
+
+/* thread private aggregation table; grows instead of being estimated */
+typedef struct {
+	aggr_bucket_t *table;
+	int8_t log_buckets;
+	size_t buckets;
+	size_t used;
+} aggr_table_t;
+
+void aggr_table_init(aggr_table_t *aggr, int8_t log_buckets);
+
+void aggr_table_free(aggr_table_t *aggr);
+
+/* no atomics: the table is only ever touched by its owner thread */
+void aggr_table_update(aggr_table_t *aggr, uint32_t aggr_key,
+		       uint64_t count_delta, aggr_sum_t sum_delta);
+
+/*
+ * shared nothing GROUP BY: every thread appends partial groups to its
+ * own radix partitions, then every partition is merged by one thread in
+ * a private table; partitions are handed out dynamically for balance
+ */
+typedef struct {
+	int threads;
+	int8_t log_partitions;
+	size_t partitions;
+	/* partial groups of every thread (threads x partitions) */
+	aggr_bucket_t **parts;
+	size_t *sizes;
+	size_t *caps;
+	/* next partition to be merged */
+	size_t next_partition;
+} aggr_exchange_t;
+
+/* Q4112_AGGR=partitioned selects the exchange in the hash join */
+int aggr_partitioned(void);
+
+void aggr_exchange_init(aggr_exchange_t *exchange, int threads);
+
+void aggr_exchange_free(aggr_exchange_t *exchange);
+
+void aggr_exchange_add(aggr_exchange_t *exchange, int thread,
+		       uint32_t aggr_key, uint64_t count, aggr_sum_t sum);
+
+/*
+ * after all threads added their groups (barrier): merge partitions until
+ * none is left and add the per group averages to sum and the number of
+ * groups to count
+ */
+void aggr_exchange_merge(aggr_exchange_t *exchange,
+			 aggr_sum_t *sum, uint64_t *count);
+
+#endif
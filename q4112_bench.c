@@ -0,0 +1,228 @@
+#include <assert.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112.h"
+#include "q4112_util.h"
+
+// values of one swept parameter, given as a comma separated list
+#define MAX_VALUES 32
+
+typedef struct {
+  double v[MAX_VALUES];
+  int n;
+} sweep_t;
+
+static void parse_sweep(sweep_t* s, const char* arg) {
+  char* copy = strdup(arg);
+  char* save = NULL;
+  char* tok;
+  s->n = 0;
+  for (tok = strtok_r(copy, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    assert(s->n < MAX_VALUES);
+    s->v[s->n++] = atof(tok);
+  }
+  assert(s->n > 0);
+  free(copy);
+}
+
+static void single(sweep_t* s, double v) {
+  s->v[0] = v;
+  s->n = 1;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+// nearest rank percentile of sorted times
+static uint64_t percentile(const uint64_t* sorted, int n, double p) {
+  int rank = (int) ceil(p * n);
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+      "usage: %s [options], every option takes a comma separated list\n"
+      "  --inner N          items tuples (1000)\n"
+      "  --inner-sel P      items selectivity (1.0)\n"
+      "  --inner-max N      max items.price (10000000)\n"
+      "  --outer N          orders tuples (1000000)\n"
+      "  --outer-sel P      orders selectivity (1.0)\n"
+      "  --outer-max N      max orders.quantity (1000)\n"
+      "  --groups N         distinct store_id, 0 for no GROUP BY (0)\n"
+      "  --hh-groups N      heavy hitter store_id (0)\n"
+      "  --hh-prob P        heavy hitter probability (0)\n"
+      "  --threads N        threads; the first is the scaling baseline (1)\n"
+      "  --warmup N         unmeasured runs per point (1)\n"
+      "  --reps N           measured runs per point (5)\n"
+      "  --format csv|json  output on stdout (csv)\n", name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  assert(max_threads > 0);
+  sweep_t inner, inner_sel, inner_max, outer, outer_sel, outer_max;
+  sweep_t groups, hh_groups, hh_prob, threads;
+  single(&inner, 1000);
+  single(&inner_sel, 1.0);
+  single(&inner_max, 10000000);
+  single(&outer, 1000000);
+  single(&outer_sel, 1.0);
+  single(&outer_max, 1000);
+  single(&groups, 0);
+  single(&hh_groups, 0);
+  single(&hh_prob, 0);
+  single(&threads, 1);
+  int warmup = 1, reps = 5, json = 0;
+  static const struct option options[] = {
+    {"inner", required_argument, NULL, 'i'},
+    {"inner-sel", required_argument, NULL, 's'},
+    {"inner-max", required_argument, NULL, 'v'},
+    {"outer", required_argument, NULL, 'o'},
+    {"outer-sel", required_argument, NULL, 'S'},
+    {"outer-max", required_argument, NULL, 'V'},
+    {"groups", required_argument, NULL, 'g'},
+    {"hh-groups", required_argument, NULL, 'h'},
+    {"hh-prob", required_argument, NULL, 'p'},
+    {"threads", required_argument, NULL, 't'},
+    {"warmup", required_argument, NULL, 'w'},
+    {"reps", required_argument, NULL, 'r'},
+    {"format", required_argument, NULL, 'f'},
+    {NULL, 0, NULL, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (opt) {
+      case 'i': parse_sweep(&inner, optarg); break;
+      case 's': parse_sweep(&inner_sel, optarg); break;
+      case 'v': parse_sweep(&inner_max, optarg); break;
+      case 'o': parse_sweep(&outer, optarg); break;
+      case 'S': parse_sweep(&outer_sel, optarg); break;
+      case 'V': parse_sweep(&outer_max, optarg); break;
+      case 'g': parse_sweep(&groups, optarg); break;
+      case 'h': parse_sweep(&hh_groups, optarg); break;
+      case 'p': parse_sweep(&hh_prob, optarg); break;
+      case 't': parse_sweep(&threads, optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'r': reps = atoi(optarg); break;
+      case 'f': json = strcmp(optarg, "json") == 0; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc || reps < 1 || warmup < 0) usage(argv[0]);
+  uint64_t* times = (uint64_t*) malloc(reps * sizeof(uint64_t));
+  assert(times != NULL);
+  if (json)
+    printf("[\n");
+  else
+    printf("inner,inner_sel,inner_max,outer,outer_sel,outer_max,groups,"
+           "hh_groups,hh_prob,threads,reps,min_ns,median_ns,p99_ns,"
+           "tuples_per_s,efficiency,valid\n");
+  int first = 1, failed = 0;
+  int a, b, c, d, e, f, g, h, k, t, r;
+  // generate the data of a point once and run every thread count on it
+  for (a = 0; a != inner.n; ++a)
+  for (b = 0; b != inner_sel.n; ++b)
+  for (c = 0; c != inner_max.n; ++c)
+  for (d = 0; d != outer.n; ++d)
+  for (e = 0; e != outer_sel.n; ++e)
+  for (f = 0; f != outer_max.n; ++f)
+  for (g = 0; g != groups.n; ++g)
+  for (h = 0; h != hh_groups.n; ++h)
+  for (k = 0; k != hh_prob.n; ++k) {
+    size_t inner_tuples = inner.v[a];
+    size_t outer_tuples = outer.v[d];
+    size_t n_groups = groups.v[g];
+    size_t n_hh_groups = hh_groups.v[h];
+    // same validity rules as q4112_main.c; skip instead of abort
+    if (inner_sel.v[b] <= 0.1 || inner_sel.v[b] > 1 ||
+        outer_sel.v[e] <= 0.1 || outer_sel.v[e] > 1 ||
+        inner_tuples == 0 || outer_tuples == 0 ||
+        outer_tuples * outer_sel.v[e] < inner_tuples * inner_sel.v[b] ||
+        n_groups > outer_tuples || n_hh_groups > n_groups ||
+        hh_prob.v[k] < 0 || hh_prob.v[k] > 1) {
+      fprintf(stderr, "skipping invalid point: inner %zu outer %zu "
+              "groups %zu\n", inner_tuples, outer_tuples, n_groups);
+      continue;
+    }
+    uint32_t* inner_keys = alloc_column(inner_tuples, "inner keys");
+    uint32_t* inner_vals = alloc_column(inner_tuples, "inner values");
+    uint32_t* outer_join_keys = alloc_column(outer_tuples, "outer join keys");
+    uint32_t* outer_aggr_keys = NULL;
+    if (n_groups > 0)
+      outer_aggr_keys = alloc_column(outer_tuples, "outer aggregate keys");
+    uint32_t* outer_vals = alloc_column(outer_tuples, "outer values");
+    uint64_t gen_res = q4112_gen(inner_keys, inner_vals, inner_tuples,
+        inner_sel.v[b], inner_max.v[c], outer_join_keys, outer_aggr_keys,
+        outer_vals, outer_tuples, outer_sel.v[e], outer_max.v[f],
+        n_groups, n_hh_groups, hh_prob.v[k]);
+    double base_ns = 0;
+    for (t = 0; t != threads.n; ++t) {
+      int n_threads = threads.v[t];
+      if (n_threads < 1 || n_threads > max_threads) {
+        fprintf(stderr, "skipping %d threads (%d available)\n",
+                n_threads, max_threads);
+        continue;
+      }
+      int valid = 1;
+      for (r = -warmup; r != reps; ++r) {
+        uint64_t run_ns = real_time();
+        uint64_t run_res = q4112_run(inner_keys, inner_vals, inner_tuples,
+            outer_join_keys, outer_aggr_keys, outer_vals, outer_tuples,
+            n_threads);
+        run_ns = real_time() - run_ns;
+        if (run_res != gen_res) valid = 0;
+        if (r >= 0) times[r] = run_ns;
+      }
+      failed |= !valid;
+      qsort(times, reps, sizeof(uint64_t), cmp_u64);
+      uint64_t median = percentile(times, reps, 0.5);
+      // speedup over the first thread count per added thread
+      if (base_ns == 0) base_ns = median * (double) n_threads;
+      double efficiency = base_ns / ((double) median * n_threads);
+      double tuples_per_s = (inner_tuples + outer_tuples) * 1e9 / median;
+      if (json) {
+        printf("%s  {\"inner\": %zu, \"inner_sel\": %g, \"inner_max\": %.0f, "
+               "\"outer\": %zu, \"outer_sel\": %g, \"outer_max\": %.0f, "
+               "\"groups\": %zu, \"hh_groups\": %zu, \"hh_prob\": %g, "
+               "\"threads\": %d, \"reps\": %d, \"min_ns\": %llu, "
+               "\"median_ns\": %llu, \"p99_ns\": %llu, "
+               "\"tuples_per_s\": %.0f, \"efficiency\": %.3f, "
+               "\"valid\": %s}", first ? "" : ",\n",
+               inner_tuples, inner_sel.v[b], inner_max.v[c], outer_tuples,
+               outer_sel.v[e], outer_max.v[f], n_groups, n_hh_groups,
+               hh_prob.v[k], n_threads, reps,
+               (unsigned long long) times[0], (unsigned long long) median,
+               (unsigned long long) percentile(times, reps, 0.99),
+               tuples_per_s, efficiency, valid ? "true" : "false");
+      } else {
+        printf("%zu,%g,%.0f,%zu,%g,%.0f,%zu,%zu,%g,%d,%d,%llu,%llu,%llu,%.0f,"
+               "%.3f,%d\n", inner_tuples, inner_sel.v[b], inner_max.v[c],
+               outer_tuples, outer_sel.v[e], outer_max.v[f], n_groups,
+               n_hh_groups, hh_prob.v[k], n_threads, reps,
+               (unsigned long long) times[0], (unsigned long long) median,
+               (unsigned long long) percentile(times, reps, 0.99),
+               tuples_per_s, efficiency, valid);
+      }
+      fflush(stdout);
+      first = 0;
+    }
+    free(inner_keys);
+    free(inner_vals);
+    free(outer_join_keys);
+    free(outer_aggr_keys);
+    free(outer_vals);
+  }
+  if (json) printf("%s]\n", first ? "" : "\n");
+  free(times);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+#include <assert.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q4112_bloom.h"
+
+/* bits set per key in its word */
+#define BLOOM_K 4
+/* keys per 64-bit word before rounding the words up to a power of two */
+#define BLOOM_WORD_KEYS 8
+/* second and third multiplier: word choice and bits within the word */
+#define BLOOM_WORD_MUL 0x85ebca6b
+#define BLOOM_BITS_MUL 0xc2b2ae35
+/* tables smaller than this stay in the cache (L2 of the big hosts) */
+#define BLOOM_MIN_TABLE_BYTES (1 << 20)
+/* sampled outer keys for the miss rate */
+#define BLOOM_SAMPLE 4096
+/* use the filter when at least this fraction of probes misses */
+#define BLOOM_MIN_MISS_RATE 0.5
+
+int bloom_mode(void)
+{
+	const char *mode = getenv("Q4112_BLOOM");
+	if (mode != NULL && strcmp(mode, "off") == 0)
+		return BLOOM_OFF;
+	if (mode != NULL && strcmp(mode, "on") == 0)
+		return BLOOM_ON;
+	return BLOOM_AUTO;
+}
+
+void bloom_init(bloom_t *bloom, size_t keys)
+{
+	bloom->log_words = 0;
+	while ((((size_t) 1) << bloom->log_words) * BLOOM_WORD_KEYS < keys)
+		bloom->log_words++;
+	bloom->words = (uint64_t *)
+		calloc(((size_t) 1) << bloom->log_words, sizeof(uint64_t));
+	assert(bloom->words != NULL);
+}
+
+void bloom_free(bloom_t *bloom)
+{
+	free(bloom->words);
+	bloom->words = NULL;
+}
+
+static inline size_t bloom_word(const bloom_t *bloom, uint32_t key)
+{
+	if (bloom->log_words == 0)
+		return 0;
+	return (uint32_t) (key * BLOOM_WORD_MUL) >> (32 - bloom->log_words);
+}
+
+static inline uint64_t bloom_bits(uint32_t key)
+{
+	uint32_t b = (uint32_t) (key * BLOOM_BITS_MUL);
+	uint64_t bits = 0;
+	int k;
+	for (k = 0; k != BLOOM_K; ++k)
+		bits |= ((uint64_t) 1) << ((b >> (6 * k)) & 63);
+	return bits;
+}
+
+void bloom_add(bloom_t *bloom, uint32_t key)
+{
+	bloom->words[bloom_word(bloom, key)] |= bloom_bits(key);
+}
+
+void bloom_add_atomic(bloom_t *bloom, uint32_t key)
+{
+	__sync_fetch_and_or(&bloom->words[bloom_word(bloom, key)],
+			    bloom_bits(key));
+}
+
+static size_t bloom_filter_scalar(const bloom_t *bloom, const uint32_t *keys,
+				  size_t n, uint32_t *sel)
+{
+	size_t i, m = 0;
+	for (i = 0; i != n; ++i) {
+		uint64_t bits = bloom_bits(keys[i]);
+		sel[m] = i;
+		m += (bloom->words[bloom_word(bloom, keys[i])] & bits) == bits;
+	}
+	return m;
+}
+
+/* 4 keys per step: 64-bit gathers of the words and variable shifts */
+__attribute__((target("avx2")))
+static size_t bloom_filter_avx2(const bloom_t *bloom, const uint32_t *keys,
+				size_t n, uint32_t *sel)
+{
+	if (bloom->log_words == 0)
+		return bloom_filter_scalar(bloom, keys, n, sel);
+	const long long *base = (const long long *) bloom->words;
+	const __m128i shift = _mm_cvtsi32_si128(32 - bloom->log_words);
+	const __m128i word_mul = _mm_set1_epi32(BLOOM_WORD_MUL);
+	const __m128i bits_mul = _mm_set1_epi32(BLOOM_BITS_MUL);
+	const __m256i low6 = _mm256_set1_epi64x(63);
+	const __m256i one = _mm256_set1_epi64x(1);
+	size_t i, m = 0;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i key = _mm_loadu_si128((const __m128i *) &keys[i]);
+		__m128i idx = _mm_srl_epi32(_mm_mullo_epi32(key, word_mul),
+					    shift);
+		__m256i word = _mm256_i32gather_epi64(base, idx, 8);
+		__m256i b = _mm256_cvtepu32_epi64(
+			_mm_mullo_epi32(key, bits_mul));
+		__m256i bits = _mm256_setzero_si256();
+		int k;
+		for (k = 0; k != BLOOM_K; ++k)
+			bits = _mm256_or_si256(bits, _mm256_sllv_epi64(
+				one, _mm256_and_si256(
+					_mm256_srli_epi64(b, 6 * k), low6)));
+		__m256i pass = _mm256_cmpeq_epi64(
+			_mm256_and_si256(word, bits), bits);
+		unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(pass));
+		while (mask) {
+			sel[m++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	size_t tail = bloom_filter_scalar(bloom, &keys[i], n - i, &sel[m]);
+	for (n = m + tail; m != n; ++m)
+		sel[m] += i;
+	return m;
+}
+
+/* 8 keys per step with 512-bit words and mask registers */
+__attribute__((target("avx512f,avx2")))
+static size_t bloom_filter_avx512(const bloom_t *bloom, const uint32_t *keys,
+				  size_t n, uint32_t *sel)
+{
+	if (bloom->log_words == 0)
+		return bloom_filter_scalar(bloom, keys, n, sel);
+	const long long *base = (const long long *) bloom->words;
+	const __m128i shift = _mm_cvtsi32_si128(32 - bloom->log_words);
+	const __m256i word_mul = _mm256_set1_epi32(BLOOM_WORD_MUL);
+	const __m256i bits_mul = _mm256_set1_epi32(BLOOM_BITS_MUL);
+	const __m512i low6 = _mm512_set1_epi64(63);
+	const __m512i one = _mm512_set1_epi64(1);
+	size_t i, m = 0;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i key = _mm256_loadu_si256((const __m256i *) &keys[i]);
+		__m256i idx = _mm256_srl_epi32(
+			_mm256_mullo_epi32(key, word_mul), shift);
+		__m512i word = _mm512_i32gather_epi64(idx, base, 8);
+		__m512i b = _mm512_cvtepu32_epi64(
+			_mm256_mullo_epi32(key, bits_mul));
+		__m512i bits = _mm512_setzero_si512();
+		int k;
+		for (k = 0; k != BLOOM_K; ++k)
+			bits = _mm512_or_si512(bits, _mm512_sllv_epi64(
+				one, _mm512_and_si512(
+					_mm512_srli_epi64(b, 6 * k), low6)));
+		unsigned mask = _mm512_cmpeq_epi64_mask(
+			_mm512_and_si512(word, bits), bits);
+		while (mask) {
+			sel[m++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	size_t tail = bloom_filter_scalar(bloom, &keys[i], n - i, &sel[m]);
+	for (n = m + tail; m != n; ++m)
+		sel[m] += i;
+	return m;
+}
+
+size_t bloom_filter(const bloom_t *bloom, const uint32_t *keys, size_t n,
+		    uint32_t *sel)
+{
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		return bloom_filter_avx512(bloom, keys, n, sel);
+	case SIMD_AVX2:
+		return bloom_filter_avx2(bloom, keys, n, sel);
+	default:
+		return bloom_filter_scalar(bloom, keys, n, sel);
+	}
+}
+
+int bloom_candidate(size_t buckets)
+{
+	return buckets * sizeof(bucket_t) >= BLOOM_MIN_TABLE_BYTES;
+}
+
+int bloom_worth(const bucket_t *table, int8_t log_buckets,
+		const uint32_t *keys, size_t n)
+{
+	uint32_t sample[BLOOM_SAMPLE];
+	uint32_t sel[BLOOM_SAMPLE];
+	uint32_t vals[BLOOM_SAMPLE];
+	size_t i, samples = n < BLOOM_SAMPLE ? n : BLOOM_SAMPLE;
+	if (samples == 0)
+		return 0;
+	/* evenly spaced sample, the outer table may be sorted */
+	for (i = 0; i != samples; ++i)
+		sample[i] = keys[i * (n / samples)];
+	size_t matches = probe_kernel()->block(table, log_buckets, sample,
+					       samples, sel, vals);
+	return samples - matches >= samples * BLOOM_MIN_MISS_RATE;
+}
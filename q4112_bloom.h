@@ -0,0 +1,58 @@
+#ifndef _Q4112_BLOOM_
+#define _Q4112_BLOOM_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "q4112_probe.h"
+
+/*
+ * register blocked Bloom filter: every key sets BLOOM_K bits of a single
+ * 64-bit word, so a check is one (cache resident) load and a compare
+ */
+typedef struct {
+	uint64_t *words;
+	int8_t log_words;
+} bloom_t;
+
+#define BLOOM_OFF 0
+#define BLOOM_ON 1
+#define BLOOM_AUTO 2
+
+/* Q4112_BLOOM=off|on|auto (default auto) */
+int bloom_mode(void);
+
+/*
+ * size the filter for keys keys: at least 8 bits per key, and the power
+ * of two word count brings that to anywhere between 8 and 16
+ */
+void bloom_init(bloom_t *bloom, size_t keys);
+
+void bloom_free(bloom_t *bloom);
+
+void bloom_add(bloom_t *bloom, uint32_t key);
+
+/* bloom_add for filters built by many threads at once */
+void bloom_add_atomic(bloom_t *bloom, uint32_t key);
+
+/*
+ * check keys[0..n) and write the positions of keys that may be in the
+ * filter to sel; returns the number of positions (vectorized)
+ */
+size_t bloom_filter(const bloom_t *bloom, const uint32_t *keys, size_t n,
+		    uint32_t *sel);
+
+/*
+ * cost check, part 1: a filter can only pay off if the hash table does
+ * not fit in the cache, otherwise a probe miss is as cheap as a check
+ */
+int bloom_candidate(size_t buckets);
+
+/*
+ * cost check, part 2: probe a sample of the n outer keys against the
+ * built table and use the filter if most of them miss
+ */
+int bloom_worth(const bucket_t *table, int8_t log_buckets,
+		const uint32_t *keys, size_t n);
+
+#endif
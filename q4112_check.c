@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "q4112_plan.h"
+#include "q4112_stream.h"
+
+#define MAX_VAL 0xFFFFFFFFu
+#define INNER_TUPLES 4
+#define OUTER_TUPLES 100
+
+typedef uint64_t (*engine_t)(Q4112_RUN_ARGS);
+
+static int failures = 0;
+
+static void check(const char* name, size_t outer_tuples, int grouped,
+                  uint64_t res) {
+  // every joined tuple is price * quantity = (2^32 - 1)^2, so is the average
+  uint64_t expected = (uint64_t) MAX_VAL * MAX_VAL;
+  if (res == expected) return;
+  fprintf(stderr, "%s: %zu orders, %s: %llu instead of %llu\n", name,
+          outer_tuples, grouped ? "grouped" : "global",
+          (unsigned long long) res, (unsigned long long) expected);
+  failures++;
+}
+
+// regression test for sums past 2^64: the query on items and orders of
+// the largest price and quantity, so that two joined tuples already wrap
+// a 64-bit sum; the kernels in use follow Q4112_SIMD, Q4112_PROBE,
+// Q4112_DENSE and Q4112_BLOOM (see the check target of the Makefile)
+int main(void) {
+  static const struct {
+    const char* name;
+    engine_t run;
+    int global_only;
+  } engines[] = {
+    { "nlj", q4112_run_nlj, 0 },
+    { "hj_1", q4112_run_hj_1, 1 },
+    { "hj", q4112_run_hj, 0 },
+    { "radix", q4112_run_radix, 0 },
+    { "smj", q4112_run_smj, 0 },
+  };
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t inner_keys[INNER_TUPLES], inner_vals[INNER_TUPLES];
+  uint32_t outer_join_keys[OUTER_TUPLES], outer_aggr_keys[OUTER_TUPLES];
+  uint32_t outer_vals[OUTER_TUPLES];
+  size_t i, e, sizes[] = { 2, OUTER_TUPLES };
+  for (i = 0; i != INNER_TUPLES; ++i) {
+    inner_keys[i] = i + 1;
+    inner_vals[i] = MAX_VAL;
+  }
+  // every fifth order refers to a missing item
+  for (i = 0; i != OUTER_TUPLES; ++i) {
+    outer_join_keys[i] = i % (INNER_TUPLES + 1) + 1;
+    outer_aggr_keys[i] = i % 3 + 1;
+    outer_vals[i] = MAX_VAL;
+  }
+  for (i = 0; i != sizeof(sizes) / sizeof(*sizes); ++i) {
+    size_t n = sizes[i];
+    int grouped;
+    for (grouped = 0; grouped != 2; ++grouped) {
+      const uint32_t* aggr_keys = grouped ? outer_aggr_keys : NULL;
+      for (e = 0; e != sizeof(engines) / sizeof(*engines); ++e) {
+        if (grouped && engines[e].global_only) continue;
+        check(engines[e].name, n, grouped,
+              engines[e].run(inner_keys, inner_vals, INNER_TUPLES,
+                             outer_join_keys, aggr_keys, outer_vals, n,
+                             engines[e].global_only ? 1 : threads));
+      }
+      q4112_stream_t* stream = stream_create(inner_keys, inner_vals,
+                                             INNER_TUPLES, grouped, threads);
+      stream_push(stream, outer_join_keys, aggr_keys, outer_vals, n);
+      check("stream", n, grouped, stream_result(stream));
+      stream_destroy(stream);
+    }
+  }
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "q4112_col.h"
+
+static const char *const col_names[] = {
+	"items.id", "items.price", "orders.item_id", "orders.store_id",
+	"orders.quantity"
+};
+
+int col_pwrite(int fd, const void *buf, size_t bytes, uint64_t offset)
+{
+	const char *p = (const char *) buf;
+	while (bytes != 0) {
+		ssize_t n = pwrite(fd, p, bytes, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		bytes -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+int col_create(const char *path, size_t inner_tuples, size_t outer_tuples,
+	       int grouped, uint64_t offsets[COL_COLUMNS])
+{
+	size_t tuples[COL_COLUMNS] = {
+		inner_tuples, inner_tuples, outer_tuples, outer_tuples,
+		outer_tuples
+	};
+	static char header_page[COL_ALIGN];
+	col_header_t *header = (col_header_t *) header_page;
+	assert(sizeof(col_header_t) <= COL_ALIGN);
+	memset(header_page, 0, sizeof(header_page));
+	memcpy(header->magic, COL_MAGIC, sizeof(header->magic));
+	header->version = COL_VERSION;
+	header->inner_tuples = inner_tuples;
+	header->outer_tuples = outer_tuples;
+
+	/*lay out the columns on page boundaries after the header*/
+	uint64_t offset = COL_ALIGN;
+	int c;
+	for (c = 0; c != COL_COLUMNS; ++c) {
+		offsets[c] = 0;
+		if (c == COL_ORDERS_STORE_ID && !grouped)
+			continue;
+		col_column_t *column = &header->column[header->columns++];
+		strncpy(column->name, col_names[c], COL_NAME_BYTES - 1);
+		column->offset = offset;
+		column->tuples = tuples[c];
+		offsets[c] = offset;
+		offset += (tuples[c] * sizeof(uint32_t) + COL_ALIGN - 1) &
+			~((uint64_t) COL_ALIGN - 1);
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	/*the padding after every column reads as zeros*/
+	if (col_pwrite(fd, header_page, COL_ALIGN, 0) != 0 ||
+	    ftruncate(fd, offset) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+int col_finish(int fd, uint64_t result)
+{
+	int res = col_pwrite(fd, &result, sizeof(result),
+			     offsetof(col_header_t, result));
+	if (close(fd) != 0)
+		res = -1;
+	return res;
+}
+
+int col_write(const char *path,
+	      const uint32_t *inner_keys, const uint32_t *inner_vals,
+	      size_t inner_tuples, const uint32_t *outer_join_keys,
+	      const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+	      size_t outer_tuples, uint64_t result)
+{
+	const uint32_t *data[COL_COLUMNS] = {
+		inner_keys, inner_vals, outer_join_keys, outer_aggr_keys,
+		outer_vals
+	};
+	size_t tuples[COL_COLUMNS] = {
+		inner_tuples, inner_tuples, outer_tuples, outer_tuples,
+		outer_tuples
+	};
+	uint64_t offsets[COL_COLUMNS];
+	int fd = col_create(path, inner_tuples, outer_tuples,
+			    outer_aggr_keys != NULL, offsets);
+	if (fd < 0)
+		return -1;
+	int res = 0, c;
+	for (c = 0; c != COL_COLUMNS && res == 0; ++c)
+		if (data[c] != NULL)
+			res = col_pwrite(fd, data[c],
+					 tuples[c] * sizeof(uint32_t),
+					 offsets[c]);
+	if (res != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return col_finish(fd, result);
+}
+
+static const uint32_t *find_column(const col_header_t *header,
+				   const char *map, size_t map_bytes,
+				   const char *name, uint64_t tuples)
+{
+	uint32_t c;
+	for (c = 0; c != header->columns; ++c) {
+		const col_column_t *column = &header->column[c];
+		if (strncmp(column->name, name, COL_NAME_BYTES) != 0)
+			continue;
+		if (column->tuples != tuples || column->offset % COL_ALIGN ||
+		    column->offset > map_bytes ||
+		    (map_bytes - column->offset) / sizeof(uint32_t) < tuples)
+			return NULL;
+		return (const uint32_t *) (map + column->offset);
+	}
+	return NULL;
+}
+
+/* fault in a read only mapping after its madvise */
+static void populate(const void *map, size_t bytes)
+{
+#ifdef MADV_POPULATE_READ
+	if (madvise((void *) map, bytes, MADV_POPULATE_READ) == 0)
+		return;
+#endif
+	const volatile char *p = (const volatile char *) map;
+	size_t i;
+	for (i = 0; i < bytes; i += COL_ALIGN)
+		(void) p[i];
+}
+
+int col_open(col_file_t *file, const char *path, int flags)
+{
+	memset(file, 0, sizeof(*file));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t) st.st_size < COL_ALIGN) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	int map_flags = MAP_SHARED;
+	int huge = 0;
+#ifdef MADV_HUGEPAGE
+	huge = (flags & COL_HUGE) != 0;
+#endif
+#ifdef MAP_POPULATE
+	/*MAP_POPULATE would fault 4K pages before the huge page advice*/
+	if ((flags & COL_POPULATE) && !huge)
+		map_flags |= MAP_POPULATE;
+#endif
+	void *map = mmap(NULL, st.st_size, PROT_READ, map_flags, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+#ifdef MADV_HUGEPAGE
+	if (huge) {
+		madvise(map, st.st_size, MADV_HUGEPAGE);
+		if (flags & COL_POPULATE)
+			populate(map, st.st_size);
+	}
+#endif
+	file->map = map;
+	file->map_bytes = st.st_size;
+
+	const col_header_t *header = (const col_header_t *) map;
+	if (memcmp(header->magic, COL_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != COL_VERSION ||
+	    header->columns > COL_MAX_COLUMNS)
+		goto invalid;
+	file->inner_tuples = header->inner_tuples;
+	file->outer_tuples = header->outer_tuples;
+	file->result = header->result;
+	file->inner_keys = find_column(header, (const char *) map,
+				       file->map_bytes, col_names[0],
+				       header->inner_tuples);
+	file->inner_vals = find_column(header, (const char *) map,
+				       file->map_bytes, col_names[1],
+				       header->inner_tuples);
+	file->outer_join_keys = find_column(header, (const char *) map,
+					    file->map_bytes, col_names[2],
+					    header->outer_tuples);
+	file->outer_aggr_keys = find_column(header, (const char *) map,
+					    file->map_bytes, col_names[3],
+					    header->outer_tuples);
+	file->outer_vals = find_column(header, (const char *) map,
+				       file->map_bytes, col_names[4],
+				       header->outer_tuples);
+	if (file->inner_keys == NULL || file->inner_vals == NULL ||
+	    file->outer_join_keys == NULL || file->outer_vals == NULL)
+		goto invalid;
+	return 0;
+invalid:
+	col_close(file);
+	errno = EINVAL;
+	return -1;
+}
+
+void col_close(col_file_t *file)
+{
+	if (file->map != NULL)
+		munmap(file->map, file->map_bytes);
+	memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,95 @@
+#ifndef _Q4112_COL_
+#define _Q4112_COL_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * column file: a one page header followed by the uint32_t columns, each
+ * starting on a page boundary so that they are mapped in place
+ *
+ *   magic "Q4112COL", version, number of columns
+ *   items and orders tuples, result of the query
+ *   per column: name ("items.id", ...), byte offset and tuples
+ */
+#define COL_MAGIC "Q4112COL"
+#define COL_VERSION 1
+#define COL_MAX_COLUMNS 8
+#define COL_NAME_BYTES 24
+#define COL_ALIGN 4096
+
+/* the columns in file order; orders.store_id is optional */
+#define COL_ITEMS_ID 0
+#define COL_ITEMS_PRICE 1
+#define COL_ORDERS_ITEM_ID 2
+#define COL_ORDERS_STORE_ID 3
+#define COL_ORDERS_QUANTITY 4
+#define COL_COLUMNS 5
+
+typedef struct {
+	char name[COL_NAME_BYTES];
+	uint64_t offset;
+	uint64_t tuples;
+} col_column_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t columns;
+	uint64_t inner_tuples;
+	uint64_t outer_tuples;
+	uint64_t result;
+	col_column_t column[COL_MAX_COLUMNS];
+} col_header_t;
+
+/* loader flags */
+#define COL_POPULATE 1
+/* transparent huge pages for the mapping (best effort) */
+#define COL_HUGE 2
+
+/* a mapped file; the columns point into the mapping */
+typedef struct {
+	uint64_t inner_tuples;
+	uint64_t outer_tuples;
+	uint64_t result;
+	const uint32_t *inner_keys;
+	const uint32_t *inner_vals;
+	const uint32_t *outer_join_keys;
+	/* NULL if the file has no orders.store_id */
+	const uint32_t *outer_aggr_keys;
+	const uint32_t *outer_vals;
+	void *map;
+	size_t map_bytes;
+} col_file_t;
+
+/* write the query input and its result; returns -1 and errno on error */
+int col_write(const char *path,
+	      const uint32_t *inner_keys, const uint32_t *inner_vals,
+	      size_t inner_tuples, const uint32_t *outer_join_keys,
+	      const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+	      size_t outer_tuples, uint64_t result);
+
+/*
+ * create a column file with room for the columns (orders.store_id if
+ * grouped) to be filled by col_pwrite, possibly from many threads at
+ * once; offsets gets the byte offset of every column (0 if missing);
+ * returns the file descriptor or -1 and errno
+ */
+int col_create(const char *path, size_t inner_tuples, size_t outer_tuples,
+	       int grouped, uint64_t offsets[COL_COLUMNS]);
+
+/* write bytes at offset of a created file; returns -1 and errno on error */
+int col_pwrite(int fd, const void *buf, size_t bytes, uint64_t offset);
+
+/* store the result of the query and close the file */
+int col_finish(int fd, uint64_t result);
+
+/*
+ * map a column file read only (MAP_POPULATE with COL_POPULATE); returns
+ * -1 and errno on error, EINVAL if the file is not a valid column file
+ */
+int col_open(col_file_t *file, const char *path, int flags);
+
+void col_close(col_file_t *file);
+
+#endif
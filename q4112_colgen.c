@@ -0,0 +1,58 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "q4112.h"
+#include "q4112_col.h"
+#include "q4112_util.h"
+
+// generate a query input once and store it as a column file
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file [inner_tuples inner_selectivity "
+            "inner_val_max outer_tuples outer_selectivity outer_val_max "
+            "groups hh_groups hh_probability]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  // same arguments and defaults as q4112_main.c, shifted by the file
+  size_t inner_tuples      = argc > 2 ? atoll(argv[2]) : 1000;
+  double inner_selectivity = argc > 3 ?  atof(argv[3]) : 1.0;
+  uint32_t inner_val_max   = argc > 4 ? atoll(argv[4]) : 10000000;
+  size_t outer_tuples      = argc > 5 ? atoll(argv[5]) : 1000000;
+  double outer_selectivity = argc > 6 ?  atof(argv[6]) : 1.0;
+  uint32_t outer_val_max   = argc > 7 ? atoll(argv[7]) : 1000;
+  size_t groups            = argc > 8 ? atoll(argv[8]) : 0;
+  size_t hh_groups         = argc > 9 ? atoll(argv[9]) : 0;
+  double hh_probability   = argc > 10 ?  atof(argv[10]) : 0.0;
+  assert(inner_selectivity > 0.1 && inner_selectivity <= 1);
+  assert(outer_selectivity > 0.1 && outer_selectivity <= 1);
+  assert(inner_tuples > 0);
+  assert(outer_tuples > 0);
+  assert(outer_tuples * outer_selectivity >=
+         inner_tuples * inner_selectivity);
+  assert(groups <= outer_tuples);
+  assert(hh_groups <= groups);
+  assert(hh_probability >= 0);
+  assert(hh_probability <= 1);
+  uint32_t* inner_keys = alloc_column(inner_tuples, "inner keys");
+  uint32_t* inner_vals = alloc_column(inner_tuples, "inner values");
+  uint32_t* outer_join_keys = alloc_column(outer_tuples, "outer join keys");
+  uint32_t* outer_aggr_keys = NULL;
+  if (groups > 0)
+    outer_aggr_keys = alloc_column(outer_tuples, "outer aggregate keys");
+  uint32_t* outer_vals = alloc_column(outer_tuples, "outer values");
+  uint64_t res = q4112_gen(inner_keys, inner_vals, inner_tuples,
+      inner_selectivity, inner_val_max,
+      outer_join_keys, outer_aggr_keys, outer_vals, outer_tuples,
+      outer_selectivity, outer_val_max, groups, hh_groups, hh_probability);
+  int failed = col_write(argv[1], inner_keys, inner_vals, inner_tuples,
+      outer_join_keys, outer_aggr_keys, outer_vals, outer_tuples, res);
+  if (failed) perror(argv[1]);
+  free(inner_keys);
+  free(inner_vals);
+  free(outer_join_keys);
+  free(outer_aggr_keys);
+  free(outer_vals);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112.h"
+#include "q4112_col.h"
+#include "q4112_util.h"
+
+// map a column file and run the query on it in place
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file [threads] [huge]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = argc > 2 ? atoi(argv[2]) : 1;
+  int flags = COL_POPULATE;
+  if (argc > 3 && strcmp(argv[3], "huge") == 0) flags |= COL_HUGE;
+  assert(threads > 0 && threads <= max_threads);
+  col_file_t file;
+  uint64_t load_ns = real_time();
+  if (col_open(&file, argv[1], flags) != 0) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  load_ns = real_time() - load_ns;
+  uint64_t run_ns = real_time();
+  uint64_t res = q4112_run(file.inner_keys, file.inner_vals,
+      file.inner_tuples, file.outer_join_keys, file.outer_aggr_keys,
+      file.outer_vals, file.outer_tuples, threads);
+  run_ns = real_time() - run_ns;
+  fprintf(stderr, "load %llu ns run %llu ns\n",
+          (unsigned long long) load_ns, (unsigned long long) run_ns);
+  int valid = res == file.result;
+  if (!valid)
+    fprintf(stderr, "wrong result %llu, expected %llu\n",
+            (unsigned long long) res, (unsigned long long) file.result);
+  col_close(&file);
+  return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,308 @@
+#include <assert.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q4112_dense.h"
+#include "q4112_mem.h"
+#include "q4112_probe.h"
+
+/*
+ * the gathers index the array with signed 32-bit offsets; bigger ranges
+ * use the scalar kernels
+ */
+#define SIMD_MAX_RANGE (((size_t) 1) << 31)
+
+static int dense_enabled(void)
+{
+	const char *mode = getenv("Q4112_DENSE");
+	return mode == NULL || strcmp(mode, "off") != 0;
+}
+
+size_t dense_bytes(uint32_t key_min, uint32_t key_max)
+{
+	size_t range = (size_t) key_max - key_min + 1;
+	return range * sizeof(uint32_t) + (range + 31) / 32 * sizeof(uint32_t);
+}
+
+int dense_worth(uint32_t key_min, uint32_t key_max, size_t buckets)
+{
+	if (!dense_enabled() || key_max < key_min)
+		return 0;
+	return dense_bytes(key_min, key_max) <= buckets * sizeof(bucket_t);
+}
+
+void dense_init(dense_t *dense, uint32_t key_min, uint32_t key_max)
+{
+	assert(key_min <= key_max);
+	dense->base = key_min;
+	dense->range = (size_t) key_max - key_min + 1;
+	dense->vals = (uint32_t *)
+		mem_table_alloc(dense->range * sizeof(uint32_t));
+	dense->bits = (uint32_t *)
+		mem_table_alloc((dense->range + 31) / 32 * sizeof(uint32_t));
+	assert(dense->vals != NULL && dense->bits != NULL);
+}
+
+void dense_free(dense_t *dense)
+{
+	mem_table_free(dense->vals, dense->range * sizeof(uint32_t));
+	mem_table_free(dense->bits,
+		       (dense->range + 31) / 32 * sizeof(uint32_t));
+	dense->vals = NULL;
+	dense->bits = NULL;
+}
+
+void dense_add(dense_t *dense, uint32_t key, uint32_t val)
+{
+	size_t k = key - dense->base;
+	assert(k < dense->range);
+	dense->vals[k] = val;
+	dense->bits[k >> 5] |= 1u << (k & 31);
+}
+
+void dense_add_atomic(dense_t *dense, uint32_t key, uint32_t val)
+{
+	size_t k = key - dense->base;
+	assert(k < dense->range);
+	dense->vals[k] = val;
+	__sync_fetch_and_or(&dense->bits[k >> 5], 1u << (k & 31));
+}
+
+static inline int dense_has(const dense_t *dense, uint32_t k)
+{
+	return k < dense->range && (dense->bits[k >> 5] >> (k & 31) & 1);
+}
+
+static size_t dense_block_scalar(const dense_t *dense, const uint32_t *keys,
+				 size_t n, uint32_t *sel, uint32_t *vals)
+{
+	size_t i, m = 0;
+	for (i = 0; i != n; ++i) {
+		uint32_t k = keys[i] - dense->base;
+		if (dense_has(dense, k)) {
+			sel[m] = i;
+			vals[m++] = dense->vals[k];
+		}
+	}
+	return m;
+}
+
+static void dense_sum_scalar(const dense_t *dense, const uint32_t *keys,
+			     const uint32_t *outer_vals, size_t n,
+			     aggr_sum_t *sum, uint64_t *count)
+{
+	size_t i;
+	aggr_sum_t s = 0;
+	uint64_t c = 0;
+	for (i = 0; i != n; ++i) {
+		uint32_t k = keys[i] - dense->base;
+		if (dense_has(dense, k)) {
+			s += dense->vals[k] * (uint64_t) outer_vals[i];
+			c += 1;
+		}
+	}
+	*sum += s;
+	*count += c;
+}
+
+/*
+ * 8 keys at once: the lanes in range gather their bitmap word, the
+ * present ones their value; returns the mask of present lanes
+ */
+__attribute__((target("avx2")))
+static inline __m256i dense_8_avx2(const dense_t *dense, __m256i key,
+				   __m256i *vals)
+{
+	const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	__m256i k = _mm256_sub_epi32(key, _mm256_set1_epi32(dense->base));
+	/*unsigned k < range as a signed compare*/
+	__m256i in = _mm256_cmpgt_epi32(
+		_mm256_xor_si256(_mm256_set1_epi32(dense->range), sign),
+		_mm256_xor_si256(k, sign));
+	__m256i word = _mm256_mask_i32gather_epi32(
+		zero, (const int *) dense->bits, _mm256_srli_epi32(k, 5),
+		in, 4);
+	__m256i bit = _mm256_and_si256(
+		_mm256_srlv_epi32(word, _mm256_and_si256(k,
+							 _mm256_set1_epi32(31))),
+		one);
+	__m256i hit = _mm256_and_si256(in, _mm256_cmpeq_epi32(bit, one));
+	*vals = _mm256_mask_i32gather_epi32(zero, (const int *) dense->vals,
+					    k, hit, 4);
+	return hit;
+}
+
+__attribute__((target("avx2")))
+static size_t dense_block_avx2(const dense_t *dense, const uint32_t *keys,
+			       size_t n, uint32_t *sel, uint32_t *vals)
+{
+	if (dense->range > SIMD_MAX_RANGE)
+		return dense_block_scalar(dense, keys, n, sel, vals);
+	uint32_t lanes[8];
+	size_t i, m = 0;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i val;
+		__m256i hit = dense_8_avx2(dense, _mm256_loadu_si256(
+						   (const __m256i *) &keys[i]),
+					   &val);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+		if (mask == 0)
+			continue;
+		_mm256_storeu_si256((__m256i *) lanes, val);
+		while (mask != 0) {
+			int l = __builtin_ctz(mask);
+			sel[m] = i + l;
+			vals[m++] = lanes[l];
+			mask &= mask - 1;
+		}
+	}
+	size_t tail = dense_block_scalar(dense, &keys[i], n - i,
+					 &sel[m], &vals[m]);
+	for (n = m + tail; m != n; ++m)
+		sel[m] += i;
+	return m;
+}
+
+__attribute__((target("avx2")))
+static void dense_sum_avx2(const dense_t *dense, const uint32_t *keys,
+			   const uint32_t *outer_vals, size_t n,
+			   aggr_sum_t *sum, uint64_t *count)
+{
+	if (dense->range > SIMD_MAX_RANGE) {
+		dense_sum_scalar(dense, keys, outer_vals, n, sum, count);
+		return;
+	}
+	__m256i acc = _mm256_setzero_si256();
+	__m256i carry = _mm256_setzero_si256();
+	uint64_t c = 0;
+	size_t i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i val;
+		__m256i hit = dense_8_avx2(dense, _mm256_loadu_si256(
+						   (const __m256i *) &keys[i]),
+					   &val);
+		__m256i ov = _mm256_loadu_si256((const __m256i *) &outer_vals[i]);
+		acc = aggr_lanes_add_avx2(acc, _mm256_mul_epu32(val, ov),
+					  &carry);
+		acc = aggr_lanes_add_avx2(acc, _mm256_mul_epu32(
+						  _mm256_srli_epi64(val, 32),
+						  _mm256_srli_epi64(ov, 32)),
+					  &carry);
+		c += __builtin_popcount(_mm256_movemask_ps(
+						_mm256_castsi256_ps(hit)));
+	}
+	*sum += aggr_lanes_sum_avx2(acc, carry);
+	*count += c;
+	dense_sum_scalar(dense, &keys[i], &outer_vals[i], n - i, sum, count);
+}
+
+/* 16 lane version of dense_8_avx2 using mask registers */
+__attribute__((target("avx512f")))
+static inline __mmask16 dense_16_avx512(const dense_t *dense, __m512i key,
+					__m512i *vals)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i k = _mm512_sub_epi32(key, _mm512_set1_epi32(dense->base));
+	__mmask16 in = _mm512_cmplt_epu32_mask(
+		k, _mm512_set1_epi32(dense->range));
+	__m512i word = _mm512_mask_i32gather_epi32(
+		zero, in, _mm512_srli_epi32(k, 5), dense->bits, 4);
+	__m512i bit = _mm512_srlv_epi32(word, _mm512_and_si512(
+						k, _mm512_set1_epi32(31)));
+	__mmask16 hit = _mm512_mask_test_epi32_mask(in, bit,
+						    _mm512_set1_epi32(1));
+	*vals = _mm512_mask_i32gather_epi32(zero, hit, k, dense->vals, 4);
+	return hit;
+}
+
+__attribute__((target("avx512f")))
+static size_t dense_block_avx512(const dense_t *dense, const uint32_t *keys,
+				 size_t n, uint32_t *sel, uint32_t *vals)
+{
+	if (dense->range > SIMD_MAX_RANGE)
+		return dense_block_scalar(dense, keys, n, sel, vals);
+	const __m512i iota = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+					      7, 6, 5, 4, 3, 2, 1, 0);
+	size_t i, m = 0;
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512i val;
+		__mmask16 hit = dense_16_avx512(dense,
+						_mm512_loadu_si512(&keys[i]),
+						&val);
+		_mm512_mask_compressstoreu_epi32(
+			&sel[m], hit,
+			_mm512_add_epi32(iota, _mm512_set1_epi32(i)));
+		_mm512_mask_compressstoreu_epi32(&vals[m], hit, val);
+		m += __builtin_popcount(hit);
+	}
+	size_t tail = dense_block_scalar(dense, &keys[i], n - i,
+					 &sel[m], &vals[m]);
+	for (n = m + tail; m != n; ++m)
+		sel[m] += i;
+	return m;
+}
+
+__attribute__((target("avx512f")))
+static void dense_sum_avx512(const dense_t *dense, const uint32_t *keys,
+			     const uint32_t *outer_vals, size_t n,
+			     aggr_sum_t *sum, uint64_t *count)
+{
+	if (dense->range > SIMD_MAX_RANGE) {
+		dense_sum_scalar(dense, keys, outer_vals, n, sum, count);
+		return;
+	}
+	__m512i acc = _mm512_setzero_si512();
+	__m512i carry = _mm512_setzero_si512();
+	uint64_t c = 0;
+	size_t i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512i val;
+		__mmask16 hit = dense_16_avx512(dense,
+						_mm512_loadu_si512(&keys[i]),
+						&val);
+		__m512i ov = _mm512_loadu_si512(&outer_vals[i]);
+		acc = aggr_lanes_add_avx512(acc, _mm512_mul_epu32(val, ov),
+					    &carry);
+		acc = aggr_lanes_add_avx512(acc, _mm512_mul_epu32(
+						    _mm512_srli_epi64(val, 32),
+						    _mm512_srli_epi64(ov, 32)),
+					    &carry);
+		c += __builtin_popcount(hit);
+	}
+	*sum += aggr_lanes_sum_avx512(acc, carry);
+	*count += c;
+	dense_sum_scalar(dense, &keys[i], &outer_vals[i], n - i, sum, count);
+}
+
+size_t dense_block(const dense_t *dense, const uint32_t *keys, size_t n,
+		   uint32_t *sel, uint32_t *vals)
+{
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		return dense_block_avx512(dense, keys, n, sel, vals);
+	case SIMD_AVX2:
+		return dense_block_avx2(dense, keys, n, sel, vals);
+	default:
+		return dense_block_scalar(dense, keys, n, sel, vals);
+	}
+}
+
+void dense_sum(const dense_t *dense, const uint32_t *keys,
+	       const uint32_t *outer_vals, size_t n,
+	       aggr_sum_t *sum, uint64_t *count)
+{
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		dense_sum_avx512(dense, keys, outer_vals, n, sum, count);
+		break;
+	case SIMD_AVX2:
+		dense_sum_avx2(dense, keys, outer_vals, n, sum, count);
+		break;
+	default:
+		dense_sum_scalar(dense, keys, outer_vals, n, sum, count);
+	}
+}
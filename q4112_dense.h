@@ -0,0 +1,68 @@
+#ifndef _Q4112_DENSE_
+#define _Q4112_DENSE_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "q4112_aggr.h"
+
+/*
+ * direct addressed items table for a dense key range: key k is present
+ * if bit k - base of bits is set and its value is vals[k - base], so a
+ * lookup is a range check and two loads instead of hashing and probing
+ */
+typedef struct {
+	uint32_t base;
+	size_t range;
+	uint32_t *vals;
+	uint32_t *bits;
+} dense_t;
+
+/* inner key range of a query; min > max if there are no keys */
+typedef struct {
+	uint32_t min;
+	uint32_t max;
+} dense_range_t;
+
+/*
+ * q4112_run of the engines that can join on the array (hj, hj_1) for a
+ * key range that is already known (the planner scans it), so that they
+ * do not scan the inner keys for it again
+ */
+uint64_t q4112_run_range(const uint32_t *inner_keys,
+			 const uint32_t *inner_vals, size_t inner_tuples,
+			 const uint32_t *outer_join_keys,
+			 const uint32_t *outer_aggr_keys,
+			 const uint32_t *outer_vals, size_t outer_tuples,
+			 int threads, const dense_range_t *range);
+
+/*
+ * the keys in [key_min, key_max] index an array that is not bigger than
+ * a hash table of buckets buckets; Q4112_DENSE=off always hashes
+ */
+int dense_worth(uint32_t key_min, uint32_t key_max, size_t buckets);
+
+/* bytes of the array and bitmap for the keys in [key_min, key_max] */
+size_t dense_bytes(uint32_t key_min, uint32_t key_max);
+
+void dense_init(dense_t *dense, uint32_t key_min, uint32_t key_max);
+
+void dense_free(dense_t *dense);
+
+void dense_add(dense_t *dense, uint32_t key, uint32_t val);
+
+/* dense_add for tables built by many threads at once */
+void dense_add_atomic(dense_t *dense, uint32_t key, uint32_t val);
+
+/*
+ * the probe_kernel_t block and sum on the array (vectorized as selected
+ * by Q4112_SIMD); block writes sel in ascending order
+ */
+size_t dense_block(const dense_t *dense, const uint32_t *keys, size_t n,
+		   uint32_t *sel, uint32_t *vals);
+
+void dense_sum(const dense_t *dense, const uint32_t *keys,
+	       const uint32_t *outer_vals, size_t n,
+	       aggr_sum_t *sum, uint64_t *count);
+
+#endif
@@ -1,74 +1,117 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include "q4112_aggr.h"
+#include "q4112_bloom.h"
+#include "q4112_dense.h"
+#include "q4112_hll.h"
+#include "q4112_index.h"
+#include "q4112_mem.h"
+#include "q4112_pack.h"
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+#include "q4112_stats.h"
+
+/* outer tuples probed per call of the (vectorized) probe kernel */
+#define PROBE_BLOCK 1024
+/* deferred global table updates per thread before they are applied */
+#define FLUSH_BUFFER 256
+/* outer tuples sketched for the group estimate: a 1/16 prefix, but at
+ * least 1M tuples
+ */
+#define ESTIMATE_SAMPLE_DIV 16
+#define ESTIMATE_SAMPLE_MIN (1 << 20)
+/* smallest global table and its fill rate before new groups spill */
+#define MIN_LOG_GLOBAL_BUCKETS 10
+#define GLOBAL_FILL_LIMIT 0.8
+/* outer keys unpacked to check if the Bloom filter pays off */
+#define BLOOM_CHECK_SAMPLE 4096
+/* the local pre-aggregation cache has sets of 4 buckets in half the L1;
+ * a thread that hits less than half of a window of lookups updates the
+ * global table (or its partitions) directly instead
+ */
+#define LOCAL_WAYS 4
+#define LOCAL_CHECK (1 << 14)
+#define LOCAL_MIN_HITS (LOCAL_CHECK / 2)
+/* L1 data cache size when sysconf does not know it */
+#define DEFAULT_L1_BYTES (32 << 10)
 
-#define BIG_NUMBER 0x9e3779b1
-#define LOCAL_CACHE_ENABLED 1
-
-typedef struct {
-	uint32_t aggr_key;
-	uint64_t sum;
-	uint32_t count;
-
-} aggr_bucket_t;
-pthread_barrier_t inner_table_barrier;
-pthread_barrier_t global_hash_barrier;
-pthread_barrier_t global_table_creation;
-pthread_barrier_t aggr_barrier;
-
-aggr_bucket_t *global_table = NULL;
-int8_t log_global_buckets = 0;
-size_t global_buckets = 0;
-int8_t log_local_buckets = 10;
-size_t local_buckets = 1024;
-
-typedef struct {
-	uint32_t key;
-	uint32_t val;
-} bucket_t;
-
+/* state of one query shared by the workers of the pool */
 typedef struct {
-	pthread_t id;
-	int thread;
 	int threads;
 	size_t inner_tuples;
 	size_t outer_tuples;
 	const uint32_t *inner_keys;
 	const uint32_t *inner_vals;
-	const uint32_t *outer_keys;
-	const uint32_t *outer_vals;
-	const uint32_t *outer_aggr_keys;
+	/* plain or packed; read in PROBE_BLOCK blocks */
+	column_t outer_keys;
+	column_t outer_vals;
+	column_t outer_aggr_keys;
 	bucket_t *table;
-	uint32_t *bitmaps_multi;
-	size_t partitions;
-	int8_t log_partitions;
-	size_t groups;
 	int8_t log_buckets;
 	size_t buckets;
-	uint64_t sum;
-	uint32_t count;
-} thread_info_t;
-
-uint32_t trailing_zero_count(uint32_t num)
-{
-	uint32_t i = num;
-	uint32_t count = 0;
-	while (i != 0) {
-		if ((i & 1) == 1)
-			return count;
-		else {
-			count++;
-			i = i >> 1;
-		}
-	}
-	return count;
-
-}
-
-int8_t log_two(size_t input)
+	/* dense keys: the array replaces the table (NULL then) */
+	dense_t dense;
+	int dense_built;
+	/* the table is a prebuilt index: the build phase only fills the
+	 * filter from its buckets
+	 */
+	int prebuilt;
+	/* per node copies of the table (Q4112_NUMA=replicate) and the
+	 * nodes a worker has claimed to copy
+	 */
+	bucket_t **replicas;
+	int *replica_claims;
+	/* filter built next to the table; used if the cost check agrees */
+	bloom_t bloom;
+	int bloom_built;
+	int use_bloom;
+	/* group sketch of every thread */
+	hll_t *sketches;
+	aggr_bucket_t *global_table;
+	int8_t log_global_buckets;
+	size_t global_buckets;
+	/* claimed buckets and the limit before new groups spill */
+	size_t global_used;
+	size_t global_limit;
+	/* shared nothing aggregation instead of the global table; also
+	 * takes the groups that spill from an underestimated global table
+	 */
+	int partitioned;
+	int spilled;
+	/* zero for the global average (no outer_aggr_keys): the probe only
+	 * sums, there are no groups to estimate or aggregate
+	 */
+	int grouped;
+	aggr_exchange_t exchange;
+	/* sets of every local cache, their lookups and hits (summed over
+	 * the threads) and the threads that stopped using theirs
+	 */
+	int8_t log_local_sets;
+	uint64_t local_lookups;
+	uint64_t local_hits;
+	int local_bypassed;
+	/* morsels of the build, estimation, probe and aggregation phase */
+	morsel_cursor_t build_cursor;
+	morsel_cursor_t estimate_cursor;
+	morsel_cursor_t probe_cursor;
+	morsel_cursor_t aggr_cursor;
+	morsel_cursor_t prefault_cursor;
+	/* partial results of every thread */
+	aggr_sum_t *sums;
+	uint64_t *counts;
+	/* per phase statistics, NULL unless asked for */
+	q4112_stats_t *stats;
+} hj_query_t;
+
+static int8_t log_two(size_t input)
 {
 	int8_t result = 0;
 	size_t x = input;
@@ -86,309 +129,812 @@ int8_t log_two(size_t input)
 /*
  * helper function to atomically update global hash table
  * given aggregation key and the change in count and sum;
- *
+ * a group that finds the table full (the estimate was too small) is
+ * spilled to the thread's aggregation partitions instead
  */
-void update_global_table(uint32_t global_aggr_key,
-			 uint32_t count_delta,
-			 uint64_t sum_delta)
+static void update_global_table(hj_query_t *query, int thread,
+				uint32_t global_aggr_key,
+				uint64_t count_delta,
+				aggr_sum_t sum_delta)
 {
+	aggr_bucket_t *global_table = query->global_table;
 	uint32_t h_glb = (uint32_t) (global_aggr_key * BIG_NUMBER);
-	h_glb >>= 32 - log_global_buckets;
+	h_glb >>= 32 - query->log_global_buckets;
+	size_t probes = 0;
 
 	/*the key is likely to be in the table already*/
 	if (global_table[h_glb].aggr_key == global_aggr_key)
 		goto increment_bucket;
 
-	/*atomically set bucket key*/
-	while (!__sync_bool_compare_and_swap(
-					     &global_table[h_glb].aggr_key,
-					     0,
-					     global_aggr_key)) {
-		/* Check if compare and swap failed because the same key was
-		 * just inserted by another thread; 
-		 * Avoid duplicate key insertion
-		 */
-		if (global_table[h_glb].aggr_key == global_aggr_key)
+	for (;;) {
+		uint32_t key = global_table[h_glb].aggr_key;
+		if (key == global_aggr_key)
 			goto increment_bucket;
-
-		h_glb = (h_glb + 1) & (global_buckets - 1);
+		if (key == 0) {
+			if (query->global_used >= query->global_limit)
+				break;
+			/*atomically set bucket key*/
+			if (__sync_bool_compare_and_swap(
+						 &global_table[h_glb].aggr_key,
+						 0,
+						 global_aggr_key)) {
+				__sync_fetch_and_add(&query->global_used, 1);
+				goto increment_bucket;
+			}
+			/* Check if compare and swap failed because the same
+			 * key was just inserted by another thread;
+			 * Avoid duplicate key insertion
+			 */
+			if (global_table[h_glb].aggr_key == global_aggr_key)
+				goto increment_bucket;
+		}
+		h_glb = (h_glb + 1) & (query->global_buckets - 1);
+		if (++probes == query->global_buckets)
+			break;
 	}
+	query->spilled = 1;
+	aggr_exchange_add(&query->exchange, thread, global_aggr_key,
+			  count_delta, sum_delta);
+	return;
 increment_bucket:
 	__sync_fetch_and_add
 		(&global_table[h_glb].count, count_delta);
-	__sync_fetch_and_add
-		(&global_table[h_glb].sum, sum_delta);
+	aggr_bucket_add_sum_atomic(&global_table[h_glb], sum_delta);
 }
 
-void *worker_thread(void *arg)
-{
-	thread_info_t *info = (thread_info_t *)arg;
-	assert(pthread_equal(pthread_self(), info->id));
+/*
+ * updates of the global table that are deferred so that their buckets
+ * can be prefetched in groups (used with the prefetching probe kernels)
+ */
+typedef struct {
+	hj_query_t *query;
+	int thread;
+	aggr_bucket_t pending[FLUSH_BUFFER];
+	size_t n;
+	size_t batch;
+	int prefetch;
+} flush_buffer_t;
 
-	/*copy info*/
-	size_t thread = info->thread;
-	size_t threads = info->threads;
-	size_t inner_tuples = info->inner_tuples;
-	const uint32_t *inner_keys = info->inner_keys;
-	const uint32_t *inner_vals = info->inner_vals;
-	bucket_t *table = info->table;
-	int8_t log_buckets = info->log_buckets;
-	size_t buckets = info->buckets;
-	size_t outer_tuples = info->outer_tuples;
-	const uint32_t *outer_keys = info->outer_keys;
-	const uint32_t *outer_vals = info->outer_vals;
-	const uint32_t *outer_aggr_keys = info->outer_aggr_keys;
-	size_t partitions = info->partitions;
-	const int8_t log_partitions = info->log_partitions;
-
-	/*thread boundaries for inner table*/
-	size_t inner_beg = (inner_tuples / threads) * (thread + 0);
-	size_t inner_end = (inner_tuples / threads) * (thread + 1);
-	if (thread + 1 == threads)
-		inner_end = inner_tuples;
-
-	/*hash inner tuples*/
-	size_t i, h;
-	for (i = inner_beg; i != inner_end; ++i) {
-		uint32_t key = inner_keys[i];
-		uint32_t val = inner_vals[i];
-		h = (uint32_t) (key * BIG_NUMBER);
-		h >>= 32 - log_buckets;
-		while (!__sync_bool_compare_and_swap(&table[h].key, 0, key))
-			h = (h + 1) & (buckets - 1);
-		table[h].val = val;
+static void flush_global(flush_buffer_t *flush)
+{
+	size_t i, j;
+	for (i = 0; i < flush->n; i += flush->batch) {
+		size_t g = flush->n - i < flush->batch ?
+			flush->n - i : flush->batch;
+		for (j = i; j != i + g; ++j) {
+			uint32_t h_glb = (uint32_t)
+				(flush->pending[j].aggr_key * BIG_NUMBER);
+			h_glb >>= 32 - flush->query->log_global_buckets;
+			__builtin_prefetch(&flush->query->global_table[h_glb], 1);
+		}
+		for (j = i; j != i + g; ++j)
+			update_global_table(flush->query, flush->thread,
+					    flush->pending[j].aggr_key,
+					    flush->pending[j].count,
+					    aggr_bucket_sum(&flush->pending[j]));
 	}
+	flush->n = 0;
+}
 
-	/*estimate unique groups*/
-	pthread_barrier_wait(&inner_table_barrier);
-	size_t outer_beg = (outer_tuples / threads) * (thread + 0);
-	size_t outer_end = (outer_tuples / threads) * (thread + 1);
-	if (thread + 1 == threads)
-		outer_end = outer_tuples;
-
-	size_t j;
-
-	/*create a local copy of the thread's own bitmap*/
-	uint32_t *bitmaps_multi_local = calloc(partitions, 4);
-	for (j = outer_beg; j != outer_end; ++j) {
-		uint32_t h = (uint32_t)(outer_aggr_keys[j] * BIG_NUMBER);
-		size_t p = h & (partitions - 1);
-		h >>= log_partitions;
-		bitmaps_multi_local[p] |= h & (-h);
+static void update_global_deferred(flush_buffer_t *flush,
+				   uint32_t global_aggr_key,
+				   uint64_t count_delta,
+				   aggr_sum_t sum_delta)
+{
+	/*partials go to the thread's own partitions instead*/
+	if (flush->query->partitioned) {
+		aggr_exchange_add(&flush->query->exchange, flush->thread,
+				  global_aggr_key, count_delta, sum_delta);
+		return;
 	}
-	/*copy the local copy to the bitmap packed in thread->info*/
-	int bitmaps_multi_beg = partitions * thread;
-	int bitmaps_multi_end = partitions * (thread + 1);
-	for (j = bitmaps_multi_beg; j != bitmaps_multi_end; ++j)
-		info->bitmaps_multi[j] = bitmaps_multi_local[j % partitions];
-
-	free(bitmaps_multi_local);
-
-	/*wait until all threads finish calculating bitmap*/
-	pthread_barrier_wait(&global_hash_barrier);
-
-	/*let thread 0 merge bitmaps and estimate groups*/
-	if (thread == 0) {
-		for (i = 0; i < partitions; ++i) {
-			for (j = 1; j < threads; ++j) {
-				info->bitmaps_multi[i] |=
-					info->bitmaps_multi[i + j * partitions];
-			}
-		}
+	if (!flush->prefetch) {
+		update_global_table(flush->query, flush->thread,
+				    global_aggr_key, count_delta, sum_delta);
+		return;
+	}
+	flush->pending[flush->n].aggr_key = global_aggr_key;
+	flush->pending[flush->n].count = count_delta;
+	aggr_bucket_set_sum(&flush->pending[flush->n], sum_delta);
+	if (++flush->n == FLUSH_BUFFER)
+		flush_global(flush);
+}
 
-		int estimation = 0;
-		for (i = 0; i < partitions; ++i)
-			estimation += ((size_t) 1)
-				<< trailing_zero_count(~info->bitmaps_multi[i]);
+/* per thread cache of partial groups in front of the global table */
+typedef struct {
+	/* the keys of a set are also packed to compare them at once */
+	uint32_t *keys;
+	aggr_bucket_t *table;
+	int8_t log_sets;
+	/* lookups and hits of the current window and before it */
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t total_lookups;
+	uint64_t total_hits;
+	int bypass;
+} local_cache_t;
 
-		/*round estimation to the nearest 2^k*/
-		estimation /= 0.77351;
-		global_buckets = estimation / 0.67;
-		log_global_buckets = log_two(global_buckets) + 1;
-		global_buckets = 1 << log_global_buckets;
-		global_table = (aggr_bucket_t *)
-			calloc(global_buckets, sizeof(aggr_bucket_t));
-
-		for (i = 0; i < global_buckets; ++i) {
-			global_table[i].aggr_key = 0;
-			global_table[i].sum = 0;
-			global_table[i].count = 0;
-		}
+/*
+ * log of the local cache sets; a cache beyond the L1 misses as much as
+ * the global table, whose updates are prefetched, and fewer sets than
+ * the L1 holds do not probe any faster
+ */
+static int8_t local_cache_log_sets(void)
+{
+	size_t l1 = mem_cache_bytes(_SC_LEVEL1_DCACHE_SIZE, DEFAULT_L1_BYTES);
+	size_t set_bytes = LOCAL_WAYS * sizeof(aggr_bucket_t);
+	int8_t log_sets = 1;
+	while ((set_bytes << (log_sets + 1)) <= l1 / 2)
+		log_sets++;
+	return log_sets;
+}
+
+/* send every cached group to the global table and empty the cache */
+static void local_cache_flush(local_cache_t *cache, flush_buffer_t *flush)
+{
+	size_t i, buckets = LOCAL_WAYS << cache->log_sets;
+	for (i = 0; i != buckets; ++i) {
+		if (cache->table[i].aggr_key == 0)
+			continue;
+		update_global_deferred(flush, cache->table[i].aggr_key,
+				       cache->table[i].count,
+				       aggr_bucket_sum(&cache->table[i]));
+		cache->keys[i] = 0;
+		cache->table[i].aggr_key = 0;
+		cache->table[i].count = 0;
 	}
+}
 
-	/*TODO: come up with a policy;
-	 * maybe compare global buckets and the number of outer tuples?
-	 */
-	aggr_bucket_t *local_table = NULL;
+/* close a window of lookups; a cache that thrashes is given up */
+static void local_cache_check(local_cache_t *cache, flush_buffer_t *flush)
+{
+	cache->total_lookups += cache->lookups;
+	cache->total_hits += cache->hits;
+	if (cache->hits < LOCAL_MIN_HITS) {
+		local_cache_flush(cache, flush);
+		cache->bypass = 1;
+	}
+	cache->lookups = 0;
+	cache->hits = 0;
+}
 
-	if (LOCAL_CACHE_ENABLED) {
-		/* create local hash table;
-		 * L1 cache = 32K; each bucket = 16 Byte
-		 * as for now, assign 2^10 buckets for local cache;
-		 */
-		local_table = (aggr_bucket_t *)
-			calloc(local_buckets,  sizeof(aggr_bucket_t));
-		assert(local_table != NULL);
-		int i;
-		for (i = 0; i < local_buckets; ++i) {
-			local_table[i].aggr_key = 0;
-			local_table[i].sum = 0;
-			local_table[i].count = 0;
-		}
+/*
+ * add one joined tuple to the thread's local cache; a miss in a full set
+ * flushes its least frequent group to the global table
+ */
+static void aggregate_local(local_cache_t *cache, flush_buffer_t *flush,
+			    uint32_t aggr_key, uint64_t extra)
+{
+	if (cache->lookups == LOCAL_CHECK)
+		local_cache_check(cache, flush);
+	if (cache->bypass) {
+		update_global_deferred(flush, aggr_key, 1, extra);
+		return;
 	}
 
-	/*join and aggregate*/
-	pthread_barrier_wait(&global_table_creation);
-	size_t o = 0;
-	uint32_t count = 0;
-	uint64_t sum = 0;
-	for (o = outer_beg; o != outer_end; ++o) {
-		uint32_t key = outer_keys[o];
-		h = (uint32_t) (key * BIG_NUMBER);
-		h >>= 32 - log_buckets;
-
-		uint32_t tab = table[h].key;
-		while (tab != 0) {
-			if (tab == key) {
-				uint64_t extra =
-					table[h].val * (uint64_t)outer_vals[o];
-				uint32_t aggr_key = outer_aggr_keys[o];
-
-				/*check if local cache is enabled*/
-				if (!LOCAL_CACHE_ENABLED) {
-					update_global_table(aggr_key, 1, extra);
-					break;
-				}
+	/*look for the key in its set*/
+	uint32_t h_local = (uint32_t)(aggr_key * BIG_NUMBER);
+	h_local >>= 32 - cache->log_sets;
+	uint32_t *keys = &cache->keys[h_local * LOCAL_WAYS];
+	aggr_bucket_t *set = &cache->table[h_local * LOCAL_WAYS];
+	size_t w, victim = 0;
+	cache->lookups++;
+	__m128i match = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) keys),
+					_mm_set1_epi32(aggr_key));
+	int mask = _mm_movemask_ps(_mm_castsi128_ps(match));
+	if (mask != 0) {
+		w = __builtin_ctz(mask);
+		set[w].count++;
+		aggr_bucket_add_sum(&set[w], extra);
+		cache->hits++;
+		return;
+	}
 
-				/*insert key to local hash table*/
-				uint32_t h_local =
-					(uint32_t)(aggr_key * BIG_NUMBER);
-				h_local >>= 32 - log_local_buckets;
-				if (local_table[h_local].aggr_key == aggr_key) {
-					local_table[h_local].count++;
-					local_table[h_local].sum += extra;
-					break;
-				}
+	/*replace the smallest group; empty buckets have no count*/
+	size_t low = set[0].count <= set[1].count ? 0 : 1;
+	size_t high = set[2].count <= set[3].count ? 2 : 3;
+	victim = set[low].count <= set[high].count ? low : high;
+	if (set[victim].aggr_key != 0)
+		update_global_deferred(flush, set[victim].aggr_key,
+				       set[victim].count,
+				       aggr_bucket_sum(&set[victim]));
+	keys[victim] = aggr_key;
+	set[victim].aggr_key = aggr_key;
+	set[victim].count = 1;
+	aggr_bucket_set_sum(&set[victim], extra);
+}
 
-				/* flush content in the bucket to global hash
-				 * table if bucket is full*/
-				if (local_table[h_local].aggr_key != 0)
-					update_global_table(
-							    local_table[h_local].aggr_key,
-							    local_table[h_local].count,
-							    local_table[h_local].sum);
-
-				local_table[h_local].aggr_key = aggr_key;
-				local_table[h_local].count = 1;
-				local_table[h_local].sum = extra;
-				break;
-				}
-			h = (h + 1) & (buckets - 1);
-			tab = table[h].key;
+/* bloom_worth on an evenly spaced sample of the outer keys */
+static int bloom_worth_outer(hj_query_t *query)
+{
+	const column_t *keys = &query->outer_keys;
+	if (keys->packed == NULL)
+		return bloom_worth(query->table, query->log_buckets,
+				   keys->plain, query->outer_tuples);
+	uint32_t sample[BLOOM_CHECK_SAMPLE];
+	size_t i, n = query->outer_tuples < BLOOM_CHECK_SAMPLE ?
+		query->outer_tuples : BLOOM_CHECK_SAMPLE;
+	for (i = 0; i != n; ++i)
+		unpack_block(keys->packed, i * (query->outer_tuples / n), 1,
+			     &sample[i]);
+	return bloom_worth(query->table, query->log_buckets, sample, n);
+}
+
+/* closing barrier of a phase, timed if the query collects statistics */
+static void phase_barrier(hj_query_t *query, q4112_pool_t *pool,
+			  int thread, int phase)
+{
+	if (query->stats == NULL) {
+		pool_barrier(pool, thread);
+		return;
+	}
+	stats_phase(query->stats, thread, phase);
+	pool_barrier(pool, thread);
+	stats_wait(query->stats, thread, phase);
+}
+
+static void worker_thread(q4112_pool_t *pool, int thread_id, void *arg)
+{
+	hj_query_t *query = (hj_query_t *)arg;
+
+	/*copy info*/
+	size_t thread = thread_id;
+	size_t threads = query->threads;
+	const uint32_t *inner_keys = query->inner_keys;
+	const uint32_t *inner_vals = query->inner_vals;
+	bucket_t *table = query->table;
+	int8_t log_buckets = query->log_buckets;
+	size_t buckets = query->buckets;
+	uint32_t key_block[PROBE_BLOCK];
+	uint32_t aggr_block[PROBE_BLOCK];
+	uint32_t val_block[PROBE_BLOCK];
+
+	if (query->stats != NULL)
+		stats_start(query->stats, thread);
+
+	/*hash inner tuples; every phase pulls morsels from its cursor*/
+	size_t i, h, beg, end;
+	while (query->prebuilt &&
+	       morsel_next(&query->build_cursor, &beg, &end))
+		for (i = beg; i != end; ++i)
+			if (table[i].key != 0)
+				bloom_add_atomic(&query->bloom, table[i].key);
+	while (query->dense_built &&
+	       morsel_next(&query->build_cursor, &beg, &end))
+		for (i = beg; i != end; ++i)
+			dense_add_atomic(&query->dense, inner_keys[i],
+					 inner_vals[i]);
+	while (!query->prebuilt && !query->dense_built &&
+	       morsel_next(&query->build_cursor, &beg, &end)) {
+		for (i = beg; i != end; ++i) {
+			uint32_t key = inner_keys[i];
+			uint32_t val = inner_vals[i];
+			h = (uint32_t) (key * BIG_NUMBER);
+			h >>= 32 - log_buckets;
+			while (!__sync_bool_compare_and_swap(&table[h].key,
+							     0, key))
+				h = (h + 1) & (buckets - 1);
+			table[h].val = val;
+			if (query->bloom_built)
+				bloom_add_atomic(&query->bloom, key);
 		}
 	}
 
-	/* flush all local buckets to global hash table*/
-	if (LOCAL_CACHE_ENABLED) {
-		for (i = 0; i < local_buckets; ++i) {
-			if (local_table[i].aggr_key != 0)
-				update_global_table(
-						    local_table[i].aggr_key,
-						    local_table[i].count,
-						    local_table[i].sum);
+	/*estimate unique groups on a sampled prefix of the outer table*/
+	phase_barrier(query, pool, thread, PHASE_BUILD);
+
+	size_t j, o, n;
+	hll_t *sketch = &query->sketches[thread];
+	hll_init(sketch);
+	while (morsel_next(&query->estimate_cursor, &beg, &end)) {
+		for (o = beg; o < end; o += PROBE_BLOCK) {
+			n = end - o < PROBE_BLOCK ? end - o : PROBE_BLOCK;
+			const uint32_t *aggr_keys =
+				column_block(&query->outer_aggr_keys, o, n,
+					     aggr_block);
+			for (j = 0; j != n; ++j)
+				hll_add(sketch, aggr_keys[j]);
 		}
-		free(local_table);
 	}
 
+	/*wait until all threads finish their sketch*/
+	phase_barrier(query, pool, thread, PHASE_ESTIMATE);
+
+	if (thread == 0 && query->bloom_built)
+		query->use_bloom = bloom_mode() == BLOOM_ON ||
+			bloom_worth_outer(query);
 
-	pthread_barrier_wait(&aggr_barrier);
-	size_t aggr_beg = (global_buckets / threads) * (thread + 0);
-	size_t aggr_end = (global_buckets / threads) * (thread + 1);
-	if (thread + 1 == threads)
-		aggr_end = global_buckets;
+	/*let thread 0 merge sketches and size the global table*/
+	if (thread == 0 && query->grouped && !query->partitioned) {
+		for (j = 1; j < threads; ++j)
+			hll_merge(&query->sketches[0], &query->sketches[j]);
+		double estimation = hll_estimate(&query->sketches[0]);
 
-	for (j = aggr_beg; j != aggr_end; ++j) {
-		if ((global_table[j].count > 0
-		     && global_table[j].aggr_key) != 0) {
-			sum += global_table[j].sum / global_table[j].count;
-			count++;
-	    }
+		/* a sample that repeats its groups has seen most of them;
+		 * otherwise scale up moderately, spilling covers the rest
+		 */
+		size_t sample = query->estimate_cursor.end;
+		if (sample < query->outer_tuples && estimation * 4 > sample)
+			estimation *= sqrt((double) query->outer_tuples / sample);
+		if (estimation > query->outer_tuples)
+			estimation = query->outer_tuples;
+
+		/*round estimation to the nearest 2^k*/
+		size_t global_buckets = estimation / 0.67;
+		query->log_global_buckets = log_two(global_buckets) + 1;
+		if (query->log_global_buckets < MIN_LOG_GLOBAL_BUCKETS)
+			query->log_global_buckets = MIN_LOG_GLOBAL_BUCKETS;
+		global_buckets = ((size_t) 1) << query->log_global_buckets;
+		query->global_buckets = global_buckets;
+		query->global_limit = global_buckets * GLOBAL_FILL_LIMIT;
+		/* the table comes zeroed, its pages are faulted in by all
+		 * workers after the barrier
+		 */
+		query->global_table = (aggr_bucket_t *)
+			mem_table_alloc(global_buckets *
+					sizeof(aggr_bucket_t));
+		morsel_init(&query->aggr_cursor, 0, global_buckets);
+		morsel_init(&query->prefault_cursor, 0, global_buckets);
 	}
 
-	info->sum = sum;
-	info->count = count;
+	/*the first worker of every node copies the table for its node*/
+	int node = mem_node();
+	if (query->replicas != NULL &&
+	    __sync_bool_compare_and_swap(&query->replica_claims[node], 0, 1)) {
+		query->replicas[node] = (bucket_t *)
+			mem_node_alloc(buckets * sizeof(bucket_t), node);
+		memcpy(query->replicas[node], table,
+		       buckets * sizeof(bucket_t));
+	}
+
+	/*join and aggregate*/
+	phase_barrier(query, pool, thread, PHASE_TABLE);
+	if (query->replicas != NULL)
+		table = query->replicas[node];
+	/* the global table stays zero, so workers that finish their share
+	 * of the page faults start probing without waiting for the others
+	 */
+	while (query->global_table != NULL &&
+	       morsel_next(&query->prefault_cursor, &beg, &end))
+		mem_prefault(query->global_table,
+			     query->global_buckets * sizeof(aggr_bucket_t),
+			     beg * sizeof(aggr_bucket_t),
+			     end * sizeof(aggr_bucket_t));
+	/*the local cache lives in the worker's scratch arena*/
+	local_cache_t cache;
+	cache.keys = NULL;
+	cache.table = NULL;
+	cache.log_sets = query->log_local_sets;
+	cache.lookups = 0;
+	cache.hits = 0;
+	cache.total_lookups = 0;
+	cache.total_hits = 0;
+	cache.bypass = 0;
+	if (query->grouped) {
+		size_t local_buckets = LOCAL_WAYS << cache.log_sets;
+		cache.keys = (uint32_t *) pool_calloc(pool, thread,
+				local_buckets * sizeof(uint32_t));
+		cache.table = (aggr_bucket_t *) pool_calloc(pool, thread,
+				local_buckets * sizeof(aggr_bucket_t));
+	}
+	const probe_kernel_t *probe = probe_kernel();
+	uint32_t sel[PROBE_BLOCK];
+	uint32_t vals[PROBE_BLOCK];
+	uint32_t bloom_sel[PROBE_BLOCK];
+	uint32_t bloom_keys[PROBE_BLOCK];
+	flush_buffer_t flush;
+	flush.query = query;
+	flush.thread = thread;
+	flush.n = 0;
+	flush.batch = probe->batch;
+	flush.prefetch = probe->prefetch;
+	size_t m, kept, matches;
+	uint64_t count = 0;
+	aggr_sum_t sum = 0;
+	aggr_sum_t join_sum = 0;
+	uint64_t join_count = 0;
+	while (morsel_next(&query->probe_cursor, &beg, &end)) {
+		for (o = beg; o < end; o += PROBE_BLOCK) {
+			n = end - o < PROBE_BLOCK ? end - o : PROBE_BLOCK;
+			const uint32_t *keys = column_block(&query->outer_keys,
+							    o, n, key_block);
+			const uint32_t *outer_vals;
+			if (!query->grouped && !query->use_bloom) {
+				/*global average: probe and sum in one kernel*/
+				outer_vals = column_block(&query->outer_vals,
+							  o, n, val_block);
+				if (query->dense_built)
+					dense_sum(&query->dense, keys,
+						  outer_vals, n, &join_sum,
+						  &join_count);
+				else
+					probe->sum(table, log_buckets, keys,
+						   outer_vals, n, &join_sum,
+						   &join_count);
+				continue;
+			}
+			if (query->dense_built) {
+				matches = dense_block(&query->dense, keys, n,
+						      sel, vals);
+			} else if (!query->use_bloom) {
+				matches = probe->block(table, log_buckets,
+						       keys, n, sel, vals);
+			} else {
+				/*probe only the keys passing the filter*/
+				kept = bloom_filter(&query->bloom, keys, n,
+						    bloom_sel);
+				for (m = 0; m != kept; ++m)
+					bloom_keys[m] = keys[bloom_sel[m]];
+				matches = probe->block(table, log_buckets,
+						       bloom_keys, kept,
+						       sel, vals);
+				for (m = 0; m != matches; ++m)
+					sel[m] = bloom_sel[sel[m]];
+			}
+			if (matches == 0)
+				continue;
+			outer_vals = column_block(&query->outer_vals, o, n,
+						  val_block);
+			if (!query->grouped) {
+				for (m = 0; m != matches; ++m)
+					join_sum += vals[m] *
+						(uint64_t) outer_vals[sel[m]];
+				join_count += matches;
+				continue;
+			}
+			const uint32_t *aggr_keys =
+				column_block(&query->outer_aggr_keys, o, n,
+					     aggr_block);
+			for (m = 0; m != matches; ++m)
+				aggregate_local(&cache, &flush,
+						aggr_keys[sel[m]],
+						vals[m] *
+						(uint64_t) outer_vals[sel[m]]);
+		}
+	}
 
-	pthread_exit(NULL);
+	/* flush all local buckets to global hash table*/
+	if (query->grouped) {
+		local_cache_flush(&cache, &flush);
+		__sync_fetch_and_add(&query->local_lookups,
+				     cache.total_lookups + cache.lookups);
+		__sync_fetch_and_add(&query->local_hits,
+				     cache.total_hits + cache.hits);
+		if (cache.bypass)
+			__sync_fetch_and_add(&query->local_bypassed, 1);
+	}
+	flush_global(&flush);
+
+	phase_barrier(query, pool, thread, PHASE_PROBE);
+	aggr_bucket_t *global_table = query->global_table;
+	if (!query->partitioned && query->spilled) {
+		/*move the table to the partitions to merge it with the spill*/
+		while (morsel_next(&query->aggr_cursor, &beg, &end))
+			for (j = beg; j != end; ++j)
+				if (global_table[j].aggr_key != 0)
+					aggr_exchange_add(&query->exchange,
+							  thread,
+							  global_table[j].aggr_key,
+							  global_table[j].count,
+							  aggr_bucket_sum(&global_table[j]));
+		phase_barrier(query, pool, thread, PHASE_SCAN);
+	}
+	if (!query->grouped) {
+		/*the average over all joined tuples*/
+		sum = join_sum;
+		count = join_count;
+	} else if (query->partitioned || query->spilled) {
+		aggr_exchange_merge(&query->exchange, &sum, &count);
+	} else {
+		while (morsel_next(&query->aggr_cursor, &beg, &end)) {
+			for (j = beg; j != end; ++j) {
+				if ((global_table[j].count > 0
+				     && global_table[j].aggr_key) != 0) {
+					sum += aggr_bucket_sum(&global_table[j]) /
+						global_table[j].count;
+					count++;
+				}
+			}
+		}
+	}
+
+	query->sums[thread] = sum;
+	query->counts[thread] = count;
+	if (query->stats != NULL) {
+		stats_phase(query->stats, thread, PHASE_SCAN);
+		stats_stop(query->stats, thread);
+	}
 }
 
-uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
-		   size_t inner_tuples, const uint32_t *outer_join_keys,
-		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
-		   size_t outer_tuples, int threads)
+static uint64_t hj_run_columns(q4112_pool_t *pool, const q4112_index_t *index,
+			       const dense_range_t *range,
+			       const uint32_t *inner_keys,
+			       const uint32_t *inner_vals, size_t inner_tuples,
+			       column_t outer_join_keys,
+			       column_t outer_aggr_keys, column_t outer_vals,
+			       size_t outer_tuples, q4112_stats_t *stats)
 {
-	int t, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
-	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	int t, threads = pool_threads(pool);
+	hj_query_t query;
 
-	/*allocate space for the hash table*/
+	/* allocate space for the hash table unless it is prebuilt or the
+	 * keys are dense enough to index an array of the same size
+	 */
 	int8_t log_buckets = 1;
 	size_t buckets = 2;
-	while (buckets * 0.67 < inner_tuples) {
-		log_buckets += 1;
-		buckets += buckets;
+	bucket_t *table = NULL;
+	uint32_t key_min, key_max;
+	query.dense_built = 0;
+	if (index != NULL) {
+		log_buckets = index->log_buckets;
+		buckets = index->buckets;
+		table = index->table;
+	} else {
+		while (buckets * 0.67 < inner_tuples) {
+			log_buckets += 1;
+			buckets += buckets;
+		}
+		if (range != NULL) {
+			key_min = range->min;
+			key_max = range->max;
+		} else {
+			pool_key_range(pool, inner_keys, inner_tuples,
+				       &key_min, &key_max);
+		}
+		query.dense_built = dense_worth(key_min, key_max, buckets);
+	}
+	if (query.dense_built) {
+		dense_init(&query.dense, key_min, key_max);
+		if (stats != NULL)
+			fprintf(stderr, "hj: direct array for keys [%u, %u]\n",
+				key_min, key_max);
+	} else if (index == NULL) {
+		table = (bucket_t *) mem_table_alloc(buckets *
+						     sizeof(bucket_t));
 	}
-	bucket_t *table = (bucket_t *) calloc(buckets, sizeof(bucket_t));
-	assert(table != NULL);
+	if (stats != NULL)
+		mem_report("hj");
+
+	/* allocate group sketches;*/
+	hll_t *sketches = (hll_t *) malloc(threads * sizeof(hll_t));
+	assert(sketches != NULL);
+
+	query.threads = threads;
+	query.inner_tuples = inner_tuples;
+	query.outer_tuples = outer_tuples;
+	query.inner_keys = inner_keys;
+	query.inner_vals = inner_vals;
+	query.outer_keys = outer_join_keys;
+	query.outer_vals = outer_vals;
+	query.outer_aggr_keys = outer_aggr_keys;
+	query.table = table;
+	query.log_buckets = log_buckets;
+	query.buckets = buckets;
+	query.prebuilt = index != NULL;
+	int node, nodes = mem_nodes();
+	query.replicas = NULL;
+	query.replica_claims = NULL;
+	if (!query.dense_built && mem_numa_mode() == MEM_NUMA_REPLICATE) {
+		query.replicas = (bucket_t **) calloc(nodes, sizeof(bucket_t *));
+		query.replica_claims = (int *) calloc(nodes, sizeof(int));
+		assert(query.replicas != NULL && query.replica_claims != NULL);
+	}
+	/*the bitmap of the array is an exact filter already*/
+	query.bloom_built = !query.dense_built &&
+		(bloom_mode() == BLOOM_ON ||
+		 (bloom_mode() == BLOOM_AUTO && bloom_candidate(buckets)));
+	if (query.bloom_built)
+		bloom_init(&query.bloom, inner_tuples);
+	query.use_bloom = 0;
+	query.sketches = sketches;
+	query.global_table = NULL;
+	query.log_global_buckets = 0;
+	query.global_buckets = 0;
+	query.global_used = 0;
+	query.global_limit = 0;
+	query.spilled = 0;
+	query.partitioned = aggr_partitioned();
+	query.grouped = outer_aggr_keys.plain != NULL ||
+		outer_aggr_keys.packed != NULL;
+	aggr_exchange_init(&query.exchange, threads);
+	query.log_local_sets = local_cache_log_sets();
+	query.local_lookups = 0;
+	query.local_hits = 0;
+	query.local_bypassed = 0;
+	size_t sample = outer_tuples / ESTIMATE_SAMPLE_DIV;
+	if (sample < ESTIMATE_SAMPLE_MIN)
+		sample = ESTIMATE_SAMPLE_MIN;
+	if (sample > outer_tuples)
+		sample = outer_tuples;
+	/*no group estimation needed without the global table*/
+	if (query.partitioned || !query.grouped)
+		sample = 0;
+	if (!query.prebuilt)
+		morsel_init(&query.build_cursor, 0, inner_tuples);
+	else
+		morsel_init(&query.build_cursor, 0,
+			    query.bloom_built ? buckets : 0);
+	morsel_init(&query.estimate_cursor, 0, sample);
+	morsel_init(&query.probe_cursor, 0, outer_tuples);
+	query.sums = (aggr_sum_t *) calloc(threads, sizeof(aggr_sum_t));
+	query.counts = (uint64_t *) calloc(threads, sizeof(uint64_t));
+	assert(query.sums != NULL && query.counts != NULL);
+	query.stats = stats;
+	if (stats != NULL)
+		stats_init(stats, threads);
+
+	/*run the workers of the pool*/
+	pool_run(pool, worker_thread, &query);
+
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	/*aggregate result*/
+	for (t = 0; t != threads; ++t) {
+		sum += query.sums[t];
+		count += query.counts[t];
+	}
+	if (stats != NULL && query.grouped)
+		fprintf(stderr, "hj: local cache of %zuKB, %.1f%% hits, "
+			"%d of %d threads bypassed it\n",
+			(LOCAL_WAYS << query.log_local_sets) *
+			sizeof(aggr_bucket_t) >> 10,
+			query.local_lookups ? 100.0 * query.local_hits /
+			query.local_lookups : 0.0,
+			query.local_bypassed, threads);
+	if (query.bloom_built)
+		bloom_free(&query.bloom);
+	aggr_exchange_free(&query.exchange);
+	mem_table_free(query.global_table,
+		       query.global_buckets * sizeof(aggr_bucket_t));
+	for (node = 0; query.replicas != NULL && node != nodes; ++node)
+		mem_table_free(query.replicas[node],
+			       buckets * sizeof(bucket_t));
+	free(query.replicas);
+	free(query.replica_claims);
+	free(query.sums);
+	free(query.counts);
+	if (query.dense_built)
+		dense_free(&query.dense);
+	if (!query.prebuilt)
+		mem_table_free(table, buckets * sizeof(bucket_t));
+	free(sketches);
+	return count ? (uint64_t) (sum / count) : 0;
 
+}
 
-	/* allocate bitmaps multiple version;*/
-	const int8_t log_partitions = 12;
-	size_t partitions = 1 << log_partitions;
-	uint32_t *bitmaps_multi = (uint32_t *)calloc(threads * partitions, 4);
-	assert(bitmaps_multi != NULL);
+/* the join on plain outer columns */
+static uint64_t hj_run(q4112_pool_t *pool, const q4112_index_t *index,
+		       const dense_range_t *range,
+		       const uint32_t *inner_keys, const uint32_t *inner_vals,
+		       size_t inner_tuples, const uint32_t *outer_join_keys,
+		       const uint32_t *outer_aggr_keys,
+		       const uint32_t *outer_vals, size_t outer_tuples,
+		       q4112_stats_t *stats)
+{
+	column_t join_keys = { outer_join_keys, NULL };
+	column_t aggr_keys = { outer_aggr_keys, NULL };
+	column_t vals = { outer_vals, NULL };
+	return hj_run_columns(pool, index, range, inner_keys, inner_vals,
+			      inner_tuples, join_keys, aggr_keys, vals,
+			      outer_tuples, stats);
+}
 
-	pthread_barrier_init(&inner_table_barrier, NULL, threads);
-	pthread_barrier_init(&global_hash_barrier, NULL, threads);
-	pthread_barrier_init(&global_table_creation, NULL, threads);
-	pthread_barrier_init(&aggr_barrier, NULL, threads);
+/* the join on a pool, reported with Q4112_STATS */
+static uint64_t hj_run_pool(q4112_pool_t *pool, const dense_range_t *range,
+			    const uint32_t *inner_keys,
+			    const uint32_t *inner_vals, size_t inner_tuples,
+			    const uint32_t *outer_join_keys,
+			    const uint32_t *outer_aggr_keys,
+			    const uint32_t *outer_vals, size_t outer_tuples)
+{
+	if (getenv("Q4112_STATS") == NULL)
+		return hj_run(pool, NULL, range, inner_keys, inner_vals,
+			      inner_tuples, outer_join_keys, outer_aggr_keys,
+			      outer_vals, outer_tuples, NULL);
+	q4112_stats_t stats;
+	uint64_t res = hj_run(pool, NULL, range, inner_keys, inner_vals,
+			      inner_tuples, outer_join_keys, outer_aggr_keys,
+			      outer_vals, outer_tuples, &stats);
+	pool_report(pool, "hj");
+	stats_report(&stats, "hj");
+	stats_free(&stats);
+	return res;
+}
 
-	/*create worker threads;*/
-	thread_info_t *info = (thread_info_t *)
-		malloc(threads * sizeof(thread_info_t));
-	assert(info != NULL);
-	for (t = 0; t != threads; ++t) {
-		info[t].outer_aggr_keys = outer_aggr_keys;
-		info[t].bitmaps_multi = bitmaps_multi;
-		info[t].partitions = partitions;
-		info[t].log_partitions = log_partitions;
-		info[t].groups = 0;
-		info[t].thread = t;
-		info[t].threads = threads;
-		info[t].inner_tuples = inner_tuples;
-		info[t].inner_keys = inner_keys;
-		info[t].inner_vals = inner_vals;
-		info[t].table = table;
-		info[t].log_buckets = log_buckets;
-		info[t].buckets = buckets;
-		info[t].threads = threads;
-		info[t].outer_tuples = outer_tuples;
-		info[t].outer_keys = outer_join_keys;
-		info[t].outer_vals = outer_vals;
-
-		pthread_create(&info[t].id, NULL, worker_thread, &info[t]);
+uint64_t q4112_run_pool(q4112_pool_t *pool,
+			const uint32_t *inner_keys, const uint32_t *inner_vals,
+			size_t inner_tuples, const uint32_t *outer_join_keys,
+			const uint32_t *outer_aggr_keys,
+			const uint32_t *outer_vals, size_t outer_tuples)
+{
+	return hj_run_pool(pool, NULL, inner_keys, inner_vals, inner_tuples,
+			   outer_join_keys, outer_aggr_keys, outer_vals,
+			   outer_tuples);
+}
 
-	}
-	uint64_t sum = 0;
-	uint32_t count = 0;
-	/*aggregate result*/
-	for (t = 0; t != threads; ++t) {
-		pthread_join(info[t].id, NULL);
-		sum += info[t].sum;
-		count += info[t].count;
-	}
-	free(global_table);
-	free(info);
-	free(table);
-	free(bitmaps_multi);
-	return sum / count;
+uint64_t q4112_run_stats(const uint32_t *inner_keys,
+			 const uint32_t *inner_vals,
+			 size_t inner_tuples,
+			 const uint32_t *outer_join_keys,
+			 const uint32_t *outer_aggr_keys,
+			 const uint32_t *outer_vals,
+			 size_t outer_tuples, int threads,
+			 q4112_stats_t *stats)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	q4112_pool_t *pool = pool_acquire(threads);
+	uint64_t res = hj_run(pool, NULL, NULL, inner_keys, inner_vals,
+			      inner_tuples, outer_join_keys, outer_aggr_keys,
+			      outer_vals, outer_tuples, stats);
+	pool_release(pool);
+	return res;
+}
 
+uint64_t q4112_run_range(const uint32_t *inner_keys,
+			 const uint32_t *inner_vals, size_t inner_tuples,
+			 const uint32_t *outer_join_keys,
+			 const uint32_t *outer_aggr_keys,
+			 const uint32_t *outer_vals, size_t outer_tuples,
+			 int threads, const dense_range_t *range)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	q4112_pool_t *pool = pool_acquire(threads);
+	uint64_t res = hj_run_pool(pool, range, inner_keys, inner_vals,
+				   inner_tuples, outer_join_keys,
+				   outer_aggr_keys, outer_vals, outer_tuples);
+	pool_release(pool);
+	return res;
+}
+
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	return q4112_run_range(inner_keys, inner_vals, inner_tuples,
+			       outer_join_keys, outer_aggr_keys, outer_vals,
+			       outer_tuples, threads, NULL);
+}
+
+uint64_t q4112_run_index(const q4112_index_t *index,
+			 const uint32_t *outer_join_keys,
+			 const uint32_t *outer_aggr_keys,
+			 const uint32_t *outer_vals,
+			 size_t outer_tuples, int threads)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	q4112_pool_t *pool = pool_acquire(threads);
+	uint64_t res = hj_run(pool, index, NULL, NULL, NULL, index->tuples,
+			      outer_join_keys, outer_aggr_keys, outer_vals,
+			      outer_tuples, NULL);
+	pool_release(pool);
+	return res;
+}
+
+uint64_t q4112_run_packed(const uint32_t *inner_keys,
+			  const uint32_t *inner_vals, size_t inner_tuples,
+			  const packed_column_t *outer_join_keys,
+			  const packed_column_t *outer_aggr_keys,
+			  const packed_column_t *outer_vals,
+			  size_t outer_tuples, int threads)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	column_t join_keys = { NULL, outer_join_keys };
+	column_t aggr_keys = { NULL, outer_aggr_keys };
+	column_t vals = { NULL, outer_vals };
+	q4112_stats_t stats;
+	q4112_stats_t *report = getenv("Q4112_STATS") != NULL ? &stats : NULL;
+	q4112_pool_t *pool = pool_acquire(threads);
+	uint64_t res = hj_run_columns(pool, NULL, NULL, inner_keys, inner_vals,
+				      inner_tuples, join_keys, aggr_keys, vals,
+				      outer_tuples, report);
+	if (report != NULL) {
+		stats_report(report, "hj packed");
+		stats_free(report);
+	}
+	pool_release(pool);
+	return res;
 }
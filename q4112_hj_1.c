@@ -2,15 +2,39 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-typedef struct {
-	uint32_t key;
-	uint32_t val;
-} bucket_t;
+#include "q4112_bloom.h"
+#include "q4112_dense.h"
+#include "q4112_mem.h"
+#include "q4112_probe.h"
 
-uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
-		   size_t inner_tuples, const uint32_t* outer_join_keys,
-		   const uint32_t* outer_aggr_keys, const uint32_t* outer_vals,
-		   size_t outer_tuples, int threads) {
+// join on a direct addressed array of the dense inner keys
+static uint64_t run_dense(const uint32_t* inner_keys,
+			  const uint32_t* inner_vals, size_t inner_tuples,
+			  uint32_t key_min, uint32_t key_max,
+			  const uint32_t* outer_join_keys,
+			  const uint32_t* outer_vals, size_t outer_tuples) {
+	dense_t dense;
+	dense_init(&dense, key_min, key_max);
+	size_t i, o, n;
+	for (i = 0; i != inner_tuples; ++i)
+		dense_add(&dense, inner_keys[i], inner_vals[i]);
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	for (o = 0; o < outer_tuples; o += 1024) {
+		n = outer_tuples - o < 1024 ? outer_tuples - o : 1024;
+		dense_sum(&dense, &outer_join_keys[o], &outer_vals[o], n,
+			  &sum, &count);
+	}
+	dense_free(&dense);
+	return (uint64_t) (sum / count);
+}
+
+uint64_t q4112_run_range(const uint32_t* inner_keys,
+			 const uint32_t* inner_vals, size_t inner_tuples,
+			 const uint32_t* outer_join_keys,
+			 const uint32_t* outer_aggr_keys,
+			 const uint32_t* outer_vals, size_t outer_tuples,
+			 int threads, const dense_range_t* range) {
 	assert(threads == 1);
 	// set the number of hash table buckets to be 2^k
 	// // the hash table fill rate will be between 1/3 and 2/3
@@ -20,12 +44,32 @@ uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
 		log_buckets += 1;
 		buckets += buckets;
 	}
+	// index an array instead if the keys are dense enough
+	uint32_t key_min = UINT32_MAX, key_max = 0;
+	size_t i, h;
+	if (range != NULL) {
+		key_min = range->min;
+		key_max = range->max;
+	}
+	for (i = 0; range == NULL && i != inner_tuples; ++i) {
+		key_min = inner_keys[i] < key_min ? inner_keys[i] : key_min;
+		key_max = inner_keys[i] > key_max ? inner_keys[i] : key_max;
+	}
+	if (dense_worth(key_min, key_max, buckets))
+		return run_dense(inner_keys, inner_vals, inner_tuples,
+				 key_min, key_max, outer_join_keys,
+				 outer_vals, outer_tuples);
 	// allocate and initialize the hash table
 	// there are no 0 keys (see header) so we use 0 for "no key"
-	bucket_t* table = (bucket_t*) calloc(buckets, sizeof(bucket_t));
+	bucket_t* table = (bucket_t*) mem_table_alloc(buckets * sizeof(bucket_t));
 	assert(table != NULL);
+	// build a filter next to the table if the table is out of cache
+	bloom_t bloom;
+	int bloom_built = bloom_mode() == BLOOM_ON ||
+		(bloom_mode() == BLOOM_AUTO && bloom_candidate(buckets));
+	if (bloom_built)
+		bloom_init(&bloom, inner_tuples);
 	// build inner table into hash table
-	size_t i, o, h;
 	for (i = 0; i != inner_tuples; ++i) {
 		uint32_t key = inner_keys[i];
 		uint32_t val = inner_vals[i];
@@ -40,33 +84,51 @@ uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
 		// set bucket
 		table[h].key = key;
 		table[h].val = val;
+		if (bloom_built)
+			bloom_add(&bloom, key);
 	}
-	// initialize single aggregate
-	uint32_t count = 0;
-	uint64_t sum = 0;
-	// probe outer table using hash table
-	for (o = 0; o != outer_tuples; ++o) {
-		uint32_t key = outer_join_keys[o];
-		// multiplicative hashing
-		h = (uint32_t) (key * 0x9e3779b1);
-		h >>= 32 - log_buckets;
-		// search for matching bucket
-		uint32_t tab = table[h].key;
-		while (tab != 0) {
-			// keys match
-			if (tab == key) {
-				// update single aggregate
-				sum += table[h].val * (uint64_t) outer_vals[o];
-				count += 1;
-				// guaranteed single match (join on primary key)
-				break;
+	// decide if the filter pays off now that the table can be sampled
+	int use_bloom = bloom_built;
+	if (use_bloom && bloom_mode() == BLOOM_AUTO)
+		use_bloom = bloom_worth(table, log_buckets, outer_join_keys,
+					outer_tuples);
+	// probe outer table using hash table (vectorized when supported)
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	size_t o, n, m;
+	if (!use_bloom) {
+		for (o = 0; o < outer_tuples; o += 1024) {
+			n = outer_tuples - o < 1024 ? outer_tuples - o : 1024;
+			probe_kernel()->sum(table, log_buckets,
+					    &outer_join_keys[o], &outer_vals[o],
+					    n, &sum, &count);
+		}
+	} else {
+		// probe only the keys that pass the filter
+		uint32_t sel[1024], keys[1024], vals[1024];
+		for (o = 0; o < outer_tuples; o += 1024) {
+			n = outer_tuples - o < 1024 ? outer_tuples - o : 1024;
+			n = bloom_filter(&bloom, &outer_join_keys[o], n, sel);
+			for (m = 0; m != n; ++m) {
+				keys[m] = outer_join_keys[o + sel[m]];
+				vals[m] = outer_vals[o + sel[m]];
 			}
-			// go to next bucket (linear probing)
-			h = (h + 1) & (buckets - 1);
-			tab = table[h].key;
+			probe_kernel()->sum(table, log_buckets, keys, vals, n,
+					    &sum, &count);
 		}
 	}
 	// cleanup and return average (integer division)
-	free(table);
-	return sum / count;
+	if (bloom_built)
+		bloom_free(&bloom);
+	mem_table_free(table, buckets * sizeof(bucket_t));
+	return (uint64_t) (sum / count);
+}
+
+uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
+		   size_t inner_tuples, const uint32_t* outer_join_keys,
+		   const uint32_t* outer_aggr_keys, const uint32_t* outer_vals,
+		   size_t outer_tuples, int threads) {
+	return q4112_run_range(inner_keys, inner_vals, inner_tuples,
+			       outer_join_keys, outer_aggr_keys, outer_vals,
+			       outer_tuples, threads, NULL);
 }
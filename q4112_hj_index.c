@@ -0,0 +1,37 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "q4112_index.h"
+
+/*
+ * the query on a prebuilt index: the items table is hashed first (and
+ * with Q4112_INDEX_FILE=path stored and mapped back in), then probed
+ */
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	q4112_index_t *index = index_build(inner_keys, inner_vals,
+					   inner_tuples, threads);
+	const char *path = getenv("Q4112_INDEX_FILE");
+	if (path != NULL) {
+		if (index_save(index, path) != 0) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		index_free(index);
+		index = index_load(path);
+		if (index == NULL) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	uint64_t res = q4112_run_index(index, outer_join_keys,
+				       outer_aggr_keys, outer_vals,
+				       outer_tuples, threads);
+	index_free(index);
+	return res;
+}
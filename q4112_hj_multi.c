@@ -0,0 +1,40 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "q4112_multi.h"
+
+#define QUERIES 4
+
+/*
+ * the query in a shared scan batch next to variants of it: small orders
+ * only, cheap items only and the global average; Q4112_STATS=1 prints
+ * the results of all of them
+ */
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	const char *names[QUERIES] = {
+		"query", "quantity <= 100", "price <= 500", "global"
+	};
+	q4112_query_t queries[QUERIES];
+	int q, grouped = outer_aggr_keys != NULL;
+	for (q = 0; q != QUERIES; ++q)
+		query_init(&queries[q], q == QUERIES - 1 ? 0 : grouped);
+	queries[1].quantity_max = 100;
+	queries[2].price_max = 500;
+	q4112_run_multi(inner_keys, inner_vals, inner_tuples,
+			outer_join_keys, outer_aggr_keys, outer_vals,
+			outer_tuples, queries, QUERIES, threads);
+	if (getenv("Q4112_STATS") != NULL)
+		for (q = 0; q != QUERIES; ++q)
+			fprintf(stderr, "multi: %-16s result %llu, %llu tuples, "
+				"%zu groups\n", names[q],
+				(unsigned long long) queries[q].result,
+				(unsigned long long) queries[q].tuples,
+				queries[q].groups);
+	return queries[0].result;
+}
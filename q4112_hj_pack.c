@@ -0,0 +1,44 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "q4112_pack.h"
+
+/*
+ * the query on bit packed orders columns: the columns are packed first
+ * (inside the timed run, Q4112_STATS=1 prints the sizes), then joined
+ */
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	const uint32_t *plain[3] = {
+		outer_join_keys, outer_aggr_keys, outer_vals
+	};
+	const char *names[3] = {
+		"orders.item_id", "orders.store_id", "orders.quantity"
+	};
+	packed_column_t packed[3];
+	int c;
+	for (c = 0; c != 3; ++c) {
+		/*no store ids for the global average*/
+		if (plain[c] == NULL)
+			continue;
+		pack_column(&packed[c], plain[c], outer_tuples);
+		if (getenv("Q4112_STATS") != NULL)
+			fprintf(stderr, "pack: %s %d bits, %zu of %zu bytes\n",
+				names[c], packed[c].bits,
+				pack_bytes(&packed[c]),
+				outer_tuples * sizeof(uint32_t));
+	}
+	uint64_t res = q4112_run_packed(inner_keys, inner_vals, inner_tuples,
+					&packed[0],
+					outer_aggr_keys ? &packed[1] : NULL,
+					&packed[2], outer_tuples, threads);
+	for (c = 0; c != 3; ++c)
+		if (plain[c] != NULL)
+			pack_free(&packed[c]);
+	return res;
+}
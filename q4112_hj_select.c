@@ -0,0 +1,43 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "q4112_select.h"
+
+/* rows printed with Q4112_STATS=1 */
+#define SHOWN_ROWS 5
+
+/*
+ * the query through the aggregate API: AVG per store (or the global
+ * AVG), then the average of the per store rows
+ */
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	q4112_select_t select;
+	q4112_result_t result;
+	select_init(&select, AGG_AVG, outer_aggr_keys != NULL);
+	q4112_select(&select, inner_keys, inner_vals, inner_tuples,
+		     outer_join_keys, outer_aggr_keys, outer_vals,
+		     outer_tuples, threads, &result);
+	select_value_t sum = 0;
+	size_t r;
+	for (r = 0; r != result.n_rows; ++r)
+		sum += result.rows[r].value;
+	if (getenv("Q4112_STATS") != NULL) {
+		fprintf(stderr, "select: %zu rows\n", result.n_rows);
+		for (r = 0; r != result.n_rows && r != SHOWN_ROWS; ++r)
+			/*an AVG row fits in 64 bits*/
+			fprintf(stderr, "select: store %u %s %llu (%llu tuples)\n",
+				result.rows[r].store_id,
+				aggregate_name(select.aggregate),
+				(unsigned long long) result.rows[r].value,
+				(unsigned long long) result.rows[r].tuples);
+	}
+	uint64_t res = result.n_rows ? (uint64_t) (sum / result.n_rows) : 0;
+	result_free(&result);
+	return res;
+}
@@ -0,0 +1,37 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "q4112_stream.h"
+
+/* orders tuples per pushed batch; Q4112_STREAM_BATCH overrides */
+#define STREAM_BATCH (1 << 20)
+
+/*
+ * the query through the streaming API: orders are pushed in batches as
+ * if they arrived from a producer
+ */
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	const char *env = getenv("Q4112_STREAM_BATCH");
+	size_t batch = env != NULL && atoll(env) > 0 ?
+		(size_t) atoll(env) : STREAM_BATCH;
+	q4112_stream_t *stream = stream_create(inner_keys, inner_vals,
+					       inner_tuples,
+					       outer_aggr_keys != NULL,
+					       threads);
+	size_t o;
+	for (o = 0; o < outer_tuples; o += batch) {
+		size_t n = outer_tuples - o < batch ? outer_tuples - o : batch;
+		stream_push(stream, &outer_join_keys[o],
+			    outer_aggr_keys ? &outer_aggr_keys[o] : NULL,
+			    &outer_vals[o], n);
+	}
+	uint64_t res = stream_result(stream);
+	assert(stream_tuples(stream) == outer_tuples);
+	stream_destroy(stream);
+	return res;
+}
@@ -0,0 +1,66 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q4112_hll.h"
+
+/* hash bits left for the register values */
+#define HLL_Q (64 - HLL_LOG_REGISTERS)
+
+void hll_init(hll_t *hll)
+{
+	memset(hll->reg, 0, sizeof(hll->reg));
+}
+
+void hll_merge(hll_t *dst, const hll_t *src)
+{
+	size_t i;
+	for (i = 0; i != HLL_REGISTERS; ++i)
+		dst->reg[i] = dst->reg[i] > src->reg[i] ?
+			dst->reg[i] : src->reg[i];
+}
+
+static double hll_sigma(double x)
+{
+	if (x == 1)
+		return INFINITY;
+	double y = 1, z = x, z_old;
+	do {
+		x *= x;
+		z_old = z;
+		z += x * y;
+		y += y;
+	} while (z != z_old);
+	return z;
+}
+
+static double hll_tau(double x)
+{
+	if (x == 0 || x == 1)
+		return 0;
+	double y = 1, z = 1 - x, z_old;
+	do {
+		x = sqrt(x);
+		z_old = z;
+		y *= 0.5;
+		z -= (1 - x) * (1 - x) * y;
+	} while (z != z_old);
+	return z / 3;
+}
+
+double hll_estimate(const hll_t *hll)
+{
+	const double m = HLL_REGISTERS;
+	uint32_t hist[HLL_Q + 2];
+	size_t i;
+	int k;
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i != HLL_REGISTERS; ++i)
+		hist[hll->reg[i]]++;
+	double z = m * hll_tau(1 - hist[HLL_Q + 1] / m);
+	for (k = HLL_Q; k >= 1; --k)
+		z = 0.5 * (z + hist[k]);
+	z += m * hll_sigma(hist[0] / m);
+	return m * m / (2 * log(2) * z);
+}
@@ -0,0 +1,43 @@
+#ifndef _Q4112_HLL_
+#define _Q4112_HLL_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* 2^12 registers: about 1.6% standard error */
+#define HLL_LOG_REGISTERS 12
+#define HLL_REGISTERS (1 << HLL_LOG_REGISTERS)
+
+/* HyperLogLog sketch of 64-bit hashes, one byte per register */
+typedef struct {
+	uint8_t reg[HLL_REGISTERS];
+} hll_t;
+
+void hll_init(hll_t *hll);
+
+static inline void hll_add(hll_t *hll, uint32_t key)
+{
+	/* 64-bit finalizer (murmur3) so every bit is usable */
+	uint64_t h = key * 0x9e3779b97f4a7c15ull;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	size_t r = h >> (64 - HLL_LOG_REGISTERS);
+	/* position of the first 1 bit after the register bits */
+	uint64_t rest = (h << HLL_LOG_REGISTERS) |
+		(((uint64_t) 1) << (HLL_LOG_REGISTERS - 1));
+	uint8_t rho = __builtin_clzll(rest) + 1;
+	if (rho > hll->reg[r])
+		hll->reg[r] = rho;
+}
+
+/* register wise maximum; a plain byte loop that vectorizes to pmaxub */
+void hll_merge(hll_t *dst, const hll_t *src);
+
+/*
+ * estimated distinct keys using the estimator of Ertl (2017), which
+ * corrects the small and large range bias without empirical tables
+ */
+double hll_estimate(const hll_t *hll);
+
+#endif
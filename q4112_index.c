@@ -0,0 +1,226 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "q4112_index.h"
+#include "q4112_pool.h"
+
+/* index file: one page header, then the buckets */
+#define INDEX_MAGIC "Q4112IDX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_BYTES 4096
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	int32_t log_buckets;
+	uint64_t tuples;
+} index_header_t;
+
+typedef struct {
+	q4112_index_t *index;
+	const uint32_t *inner_keys;
+	const uint32_t *inner_vals;
+	morsel_cursor_t cursor;
+} index_build_t;
+
+static void build_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	index_build_t *build = (index_build_t *) arg;
+	bucket_t *table = build->index->table;
+	size_t mask = build->index->buckets - 1;
+	int8_t log_buckets = build->index->log_buckets;
+	size_t i, h, beg, end;
+	while (morsel_next(&build->cursor, &beg, &end)) {
+		for (i = beg; i != end; ++i) {
+			uint32_t key = build->inner_keys[i];
+			h = (uint32_t) (key * BIG_NUMBER);
+			h >>= 32 - log_buckets;
+			while (!__sync_bool_compare_and_swap(&table[h].key,
+							     0, key))
+				h = (h + 1) & mask;
+			table[h].val = build->inner_vals[i];
+		}
+	}
+}
+
+static void index_alloc(q4112_index_t *index, size_t tuples)
+{
+	index->log_buckets = 1;
+	index->buckets = 2;
+	while (index->buckets * 0.67 < tuples) {
+		index->log_buckets += 1;
+		index->buckets += index->buckets;
+	}
+	index->table = (bucket_t *) calloc(index->buckets, sizeof(bucket_t));
+	assert(index->table != NULL);
+}
+
+q4112_index_t *index_build(const uint32_t *inner_keys,
+			   const uint32_t *inner_vals,
+			   size_t inner_tuples, int threads)
+{
+	q4112_index_t *index = (q4112_index_t *)
+		calloc(1, sizeof(q4112_index_t));
+	assert(index != NULL);
+	index_alloc(index, inner_tuples);
+	index->tuples = inner_tuples;
+
+	index_build_t build;
+	build.index = index;
+	build.inner_keys = inner_keys;
+	build.inner_vals = inner_vals;
+	morsel_init(&build.cursor, 0, inner_tuples);
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_run(pool, build_thread, &build);
+	pool_release(pool);
+	return index;
+}
+
+static void index_release_table(q4112_index_t *index)
+{
+	if (index->map != NULL)
+		munmap(index->map, index->map_bytes);
+	else
+		free(index->table);
+	index->map = NULL;
+	index->table = NULL;
+}
+
+void index_free(q4112_index_t *index)
+{
+	index_release_table(index);
+	free(index);
+}
+
+/* bucket of key, or the empty bucket where it would be inserted */
+static bucket_t *index_find(bucket_t *table, int8_t log_buckets,
+			    uint32_t key)
+{
+	size_t mask = (((size_t) 1) << log_buckets) - 1;
+	size_t h = (uint32_t) (key * BIG_NUMBER) >> (32 - log_buckets);
+	while (table[h].key != key && table[h].key != 0)
+		h = (h + 1) & mask;
+	return &table[h];
+}
+
+static void index_grow(q4112_index_t *index)
+{
+	q4112_index_t bigger;
+	size_t i;
+	memset(&bigger, 0, sizeof(bigger));
+	index_alloc(&bigger, (index->tuples + 1) * 2);
+	for (i = 0; i != index->buckets; ++i)
+		if (index->table[i].key != 0)
+			*index_find(bigger.table, bigger.log_buckets,
+				    index->table[i].key) = index->table[i];
+	index_release_table(index);
+	index->table = bigger.table;
+	index->log_buckets = bigger.log_buckets;
+	index->buckets = bigger.buckets;
+}
+
+void index_upsert(q4112_index_t *index, uint32_t key, uint32_t val)
+{
+	assert(key != 0);
+	bucket_t *bucket = index_find(index->table, index->log_buckets, key);
+	if (bucket->key == 0) {
+		if ((index->tuples + 1) > index->buckets * 0.67) {
+			index_grow(index);
+			bucket = index_find(index->table, index->log_buckets,
+					    key);
+		}
+		bucket->key = key;
+		index->tuples++;
+	}
+	bucket->val = val;
+}
+
+int index_save(const q4112_index_t *index, const char *path)
+{
+	static char header_page[INDEX_HEADER_BYTES];
+	index_header_t *header = (index_header_t *) header_page;
+	memset(header_page, 0, sizeof(header_page));
+	memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+	header->version = INDEX_VERSION;
+	header->log_buckets = index->log_buckets;
+	header->tuples = index->tuples;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	const char *parts[2] = { header_page, (const char *) index->table };
+	size_t bytes[2] = {
+		INDEX_HEADER_BYTES, index->buckets * sizeof(bucket_t)
+	};
+	int p, res = 0;
+	for (p = 0; p != 2 && res == 0; ++p) {
+		while (bytes[p] != 0) {
+			ssize_t n = write(fd, parts[p], bytes[p]);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				res = -1;
+				break;
+			}
+			parts[p] += n;
+			bytes[p] -= n;
+		}
+	}
+	if (close(fd) != 0)
+		res = -1;
+	return res;
+}
+
+q4112_index_t *index_load(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t) st.st_size < INDEX_HEADER_BYTES) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	/*private and writable so that upserts do not touch the file*/
+	int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	map_flags |= MAP_POPULATE;
+#endif
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			 map_flags, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	const index_header_t *header = (const index_header_t *) map;
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != INDEX_VERSION ||
+	    header->log_buckets < 1 || header->log_buckets > 32 ||
+	    (st.st_size - INDEX_HEADER_BYTES) / sizeof(bucket_t) <
+	    ((size_t) 1) << header->log_buckets) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	q4112_index_t *index = (q4112_index_t *)
+		calloc(1, sizeof(q4112_index_t));
+	assert(index != NULL);
+	index->log_buckets = header->log_buckets;
+	index->buckets = ((size_t) 1) << header->log_buckets;
+	index->tuples = header->tuples;
+	index->table = (bucket_t *) ((char *) map + INDEX_HEADER_BYTES);
+	index->map = map;
+	index->map_bytes = st.st_size;
+	return index;
+}
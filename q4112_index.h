@@ -0,0 +1,53 @@
+#ifndef _Q4112_INDEX_
+#define _Q4112_INDEX_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "q4112_probe.h"
+
+/*
+ * prebuilt items table (the bucket_t table of the hash join) kept across
+ * queries; queries only probe it, so any number of them may run on the
+ * same index as long as nobody updates it at the same time
+ */
+typedef struct {
+	bucket_t *table;
+	int8_t log_buckets;
+	size_t buckets;
+	size_t tuples;
+	/* set if the table lives in a private mapping of an index file */
+	void *map;
+	size_t map_bytes;
+} q4112_index_t;
+
+/* hash the items on a pool of threads */
+q4112_index_t *index_build(const uint32_t *inner_keys,
+			   const uint32_t *inner_vals,
+			   size_t inner_tuples, int threads);
+
+void index_free(q4112_index_t *index);
+
+/*
+ * insert an item or update its price; the table doubles when it gets
+ * 2/3 full, a mapped table is copied out of the file at that point
+ */
+void index_upsert(q4112_index_t *index, uint32_t key, uint32_t val);
+
+/* store the table; returns -1 and errno on error */
+int index_save(const q4112_index_t *index, const char *path);
+
+/*
+ * map a stored table copy on write; returns NULL and errno on error,
+ * EINVAL if the file is not an index file
+ */
+q4112_index_t *index_load(const char *path);
+
+/* the hash join probing a prebuilt index instead of building a table */
+uint64_t q4112_run_index(const q4112_index_t *index,
+			 const uint32_t *outer_join_keys,
+			 const uint32_t *outer_aggr_keys,
+			 const uint32_t *outer_vals,
+			 size_t outer_tuples, int threads);
+
+#endif
@@ -2,32 +2,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <unistd.h>
 
 #include "q4112.h"
-
-uint64_t real_time(void) {
-  struct timespec t;
-  assert(clock_gettime(CLOCK_REALTIME, &t) == 0);
-  return t.tv_sec * 1000 * 1000 * 1000 + t.tv_nsec;
-}
-
-const char* add_commas(uint64_t x) {
-  static char buf[32];
-  int digit = 0;
-  size_t i = sizeof(buf) / sizeof(char);
-  buf[--i] = '\0';
-  do {
-    if (digit++ == 3) {
-      buf[--i] = ',';
-      digit = 1;
-    }
-    buf[--i] = (x % 10) + '0';
-    x /= 10;
-  } while (x);
-  return &buf[i];
-}
+#include "q4112_util.h"
 
 int main(int argc, char* argv[]) {
   // get number of hardware threads
@@ -58,20 +36,14 @@ int main(int argc, char* argv[]) {
   assert(threads > 0);
   assert(threads <= max_threads);
   // allocate space for inner table
-  uint32_t* inner_keys = (uint32_t*) malloc(inner_tuples * 4);
-  assert(inner_keys != NULL);
-  uint32_t* inner_vals = (uint32_t*) malloc(inner_tuples * 4);
-  assert(inner_vals != NULL);
+  uint32_t* inner_keys = alloc_column(inner_tuples, "inner keys");
+  uint32_t* inner_vals = alloc_column(inner_tuples, "inner values");
   // allocate space for outer table
-  uint32_t* outer_join_keys = (uint32_t*) malloc(outer_tuples * 4);
-  assert(outer_join_keys != NULL);
+  uint32_t* outer_join_keys = alloc_column(outer_tuples, "outer join keys");
   uint32_t* outer_aggr_keys = NULL;
-  if (groups > 0) {
-    outer_aggr_keys = (uint32_t*) malloc(outer_tuples * 4);
-    assert(outer_aggr_keys != NULL);
-  }
-  uint32_t* outer_vals = (uint32_t*) malloc(outer_tuples * 4);
-  assert(outer_vals != NULL);
+  if (groups > 0)
+    outer_aggr_keys = alloc_column(outer_tuples, "outer aggregate keys");
+  uint32_t* outer_vals = alloc_column(outer_tuples, "outer values");
   /*
   // print max number of threads
   fprintf(stderr, "Threads: %d / %d\n", threads, max_threads);
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "q4112_mem.h"
+
+/* tables of at least one huge page are mapped instead of calloc'ed */
+#define HUGE_PAGE_BYTES ((size_t) 2 << 20)
+/* nodes of the one word node mask passed to mbind */
+#define MAX_NODES 64
+/* mbind(2) policies; the syscall needs no libnuma */
+#define POLICY_DEFAULT 0
+#define POLICY_BIND 2
+#define POLICY_INTERLEAVE 3
+
+#define HUGE_OFF 0
+#define HUGE_THP 1
+#define HUGE_TLB 2
+
+static const char *numa_names[] = { "first touch", "interleaved",
+				    "replicated" };
+static const char *huge_names[] = { "4K", "transparent huge",
+				    "hugetlb" };
+/* modes the mapped tables actually got, one bit per mode */
+static int huge_used;
+
+int mem_numa_mode(void)
+{
+	const char *mode = getenv("Q4112_NUMA");
+	if (mode != NULL && strcmp(mode, "off") == 0)
+		return MEM_NUMA_OFF;
+	if (mode != NULL && strcmp(mode, "replicate") == 0)
+		return MEM_NUMA_REPLICATE;
+	return MEM_NUMA_INTERLEAVE;
+}
+
+static int huge_mode(void)
+{
+	const char *mode = getenv("Q4112_HUGE");
+	if (mode != NULL && strcmp(mode, "off") == 0)
+		return HUGE_OFF;
+	if (mode != NULL && strcmp(mode, "hugetlb") == 0)
+		return HUGE_TLB;
+	return HUGE_THP;
+}
+
+int mem_nodes(void)
+{
+	char list[256];
+	FILE *file = fopen("/sys/devices/system/node/online", "r");
+	if (file == NULL)
+		return 1;
+	char *line = fgets(list, sizeof(list), file);
+	fclose(file);
+	if (line == NULL)
+		return 1;
+	/*a list of ranges like 0-1,4; the highest node bounds the mask*/
+	int node, nodes = 1;
+	char *p = list;
+	while (*p != '\0') {
+		if (*p < '0' || *p > '9') {
+			p++;
+			continue;
+		}
+		node = strtol(p, &p, 10);
+		if (node + 1 > nodes)
+			nodes = node + 1;
+	}
+	return nodes < MAX_NODES ? nodes : MAX_NODES;
+}
+
+int mem_node(void)
+{
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+		return 0;
+	return node < MAX_NODES ? (int) node : 0;
+}
+
+static size_t mapped_bytes(size_t bytes)
+{
+	return (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+}
+
+/*
+ * map zeroed pages and set their NUMA policy before the first touch;
+ * failing advice or policies (no huge pages, no NUMA) are ignored
+ */
+static void *map_table(size_t bytes, int policy, uint64_t nodes)
+{
+	size_t size = mapped_bytes(bytes);
+	int huge = huge_mode();
+	void *table = MAP_FAILED;
+	if (huge == HUGE_TLB)
+		table = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (table == MAP_FAILED) {
+		/*
+		 * over-map by a huge page and trim, so that the table starts
+		 * on a huge page boundary and all of it can be backed by THP
+		 */
+		char *map = (char *) mmap(NULL, size + HUGE_PAGE_BYTES,
+					  PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(map != MAP_FAILED);
+		char *base = (char *) (((uintptr_t) map + HUGE_PAGE_BYTES - 1) &
+				       ~(uintptr_t) (HUGE_PAGE_BYTES - 1));
+		if (base != map)
+			munmap(map, base - map);
+		munmap(base + size, map + HUGE_PAGE_BYTES - base);
+		table = base;
+		if (huge == HUGE_TLB)
+			huge = HUGE_THP;
+		if (huge != HUGE_OFF)
+			madvise(table, size, MADV_HUGEPAGE);
+	}
+	__sync_fetch_and_or(&huge_used, 1 << huge);
+	if (policy != POLICY_DEFAULT) {
+		unsigned long mask = nodes;
+		syscall(SYS_mbind, table, size, policy, &mask,
+			sizeof(mask) * 8, 0);
+	}
+	return table;
+}
+
+void *mem_table_alloc(size_t bytes)
+{
+	if (bytes < HUGE_PAGE_BYTES) {
+		void *table = calloc(1, bytes);
+		assert(table != NULL || bytes == 0);
+		return table;
+	}
+	int nodes = mem_nodes();
+	if (nodes == 1 || mem_numa_mode() == MEM_NUMA_OFF)
+		return map_table(bytes, POLICY_DEFAULT, 0);
+	uint64_t all = nodes == 64 ? ~(uint64_t) 0 :
+		(((uint64_t) 1) << nodes) - 1;
+	return map_table(bytes, POLICY_INTERLEAVE, all);
+}
+
+void *mem_node_alloc(size_t bytes, int node)
+{
+	/*small tables are placed by the first touch of their node*/
+	if (bytes < HUGE_PAGE_BYTES)
+		return mem_table_alloc(bytes);
+	if (mem_nodes() == 1)
+		return map_table(bytes, POLICY_DEFAULT, 0);
+	return map_table(bytes, POLICY_BIND, ((uint64_t) 1) << node);
+}
+
+void mem_prefault(void *table, size_t bytes, size_t beg, size_t end)
+{
+	/*calloc'ed tables are not mapped by us; kernels before 5.14 fault
+	 * lazily instead
+	 */
+	if (bytes < HUGE_PAGE_BYTES || end <= beg)
+		return;
+	size_t page = sysconf(_SC_PAGESIZE);
+	beg &= ~(page - 1);
+	end = (end + page - 1) & ~(page - 1);
+#ifdef MADV_POPULATE_WRITE
+	madvise((char *) table + beg, end - beg, MADV_POPULATE_WRITE);
+#endif
+}
+
+void mem_table_free(void *table, size_t bytes)
+{
+	if (bytes < HUGE_PAGE_BYTES)
+		free(table);
+	else if (table != NULL)
+		munmap(table, mapped_bytes(bytes));
+}
+
+size_t mem_cache_bytes(int name, size_t fallback)
+{
+	long bytes = sysconf(name);
+	return bytes > 0 ? (size_t) bytes : fallback;
+}
+
+void mem_report(const char *name)
+{
+	/*
+	 * the pages the tables got, since hugetlb falls back to THP; the
+	 * requested mode until a table is mapped
+	 */
+	int used = huge_used;
+	const char *pages = huge_names[huge_mode()];
+	if (used == (1 << HUGE_TLB | 1 << HUGE_THP))
+		pages = "hugetlb and transparent huge";
+	else if (used != 0)
+		pages = huge_names[__builtin_ctz(used)];
+	fprintf(stderr, "%s: %d NUMA nodes, %s tables on %s pages\n", name,
+		mem_nodes(), numa_names[mem_numa_mode()], pages);
+}
@@ -0,0 +1,52 @@
+#ifndef _Q4112_MEM_
+#define _Q4112_MEM_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * placement of the big shared tables: Q4112_NUMA=interleave (default)
+ * spreads their pages over all nodes, replicate gives every node a copy
+ * of the read-only build table as well, off leaves placement to first
+ * touch; Q4112_HUGE=thp (default) advises transparent huge pages,
+ * hugetlb maps reserved huge pages (thp if there are none), off uses
+ * 4K pages
+ */
+#define MEM_NUMA_OFF 0
+#define MEM_NUMA_INTERLEAVE 1
+#define MEM_NUMA_REPLICATE 2
+
+int mem_numa_mode(void);
+
+/* online NUMA nodes (1 if unknown) */
+int mem_nodes(void);
+
+/* NUMA node of the cpu the calling thread runs on */
+int mem_node(void);
+
+/*
+ * zeroed memory for a table shared by all workers; tables of at least a
+ * huge page are mapped on huge pages and interleaved, smaller ones come
+ * from calloc; free with the same size
+ */
+void *mem_table_alloc(size_t bytes);
+
+void mem_table_free(void *table, size_t bytes);
+
+/*
+ * fault in the pages of bytes [beg, end) of a table from mem_table_alloc
+ * without changing them, so that workers can touch their slices while
+ * others already use the table
+ */
+void mem_prefault(void *table, size_t bytes, size_t beg, size_t end);
+
+/* mem_table_alloc with all pages on one node (for replicas) */
+void *mem_node_alloc(size_t bytes, int node);
+
+/* bytes of the sysconf cache name, fallback if it is unknown */
+size_t mem_cache_bytes(int name, size_t fallback);
+
+/* print the placement of the tables to stderr */
+void mem_report(const char *name);
+
+#endif
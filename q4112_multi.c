@@ -0,0 +1,204 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "q4112_aggr.h"
+#include "q4112_index.h"
+#include "q4112_multi.h"
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+
+/* outer tuples probed per call of the probe kernel */
+#define PROBE_BLOCK 1024
+/* initial group table of every thread and query; it grows when needed */
+#define LOG_GROUP_BUCKETS 10
+
+typedef struct {
+	const q4112_index_t *index;
+	const uint32_t *outer_keys;
+	const uint32_t *outer_aggr_keys;
+	const uint32_t *outer_vals;
+	q4112_query_t *queries;
+	int n_queries;
+	int grouped;
+	/* state of every thread and query (thread * n_queries + query) */
+	aggr_table_t *groups;
+	aggr_sum_t *sums;
+	uint64_t *counts;
+	morsel_cursor_t cursor;
+} multi_t;
+
+void query_init(q4112_query_t *query, int grouped)
+{
+	query->grouped = grouped;
+	query->quantity_min = 0;
+	query->quantity_max = UINT32_MAX;
+	query->price_min = 0;
+	query->price_max = UINT32_MAX;
+	query->result = 0;
+	query->tuples = 0;
+	query->groups = 0;
+}
+
+/* feed the matches of one block to one query */
+static void multi_aggregate(multi_t *multi, int thread, int q, size_t matches,
+			    const uint32_t *prices, const uint32_t *quantities,
+			    const uint32_t *aggr_keys)
+{
+	const q4112_query_t *query = &multi->queries[q];
+	size_t slot = (size_t) thread * multi->n_queries + q;
+	uint32_t quantity_range = query->quantity_max - query->quantity_min;
+	uint32_t price_range = query->price_max - query->price_min;
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	size_t m;
+	for (m = 0; m != matches; ++m) {
+		/*both range checks with one unsigned compare each*/
+		if (quantities[m] - query->quantity_min > quantity_range ||
+		    prices[m] - query->price_min > price_range)
+			continue;
+		uint64_t val = prices[m] * (uint64_t) quantities[m];
+		if (query->grouped)
+			aggr_table_update(&multi->groups[slot], aggr_keys[m],
+					  1, val);
+		sum += val;
+		count++;
+	}
+	multi->sums[slot] += sum;
+	multi->counts[slot] += count;
+}
+
+static void multi_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	multi_t *multi = (multi_t *) arg;
+	const q4112_index_t *index = multi->index;
+	const probe_kernel_t *probe = probe_kernel();
+	uint32_t sel[PROBE_BLOCK];
+	uint32_t prices[PROBE_BLOCK];
+	uint32_t quantities[PROBE_BLOCK];
+	uint32_t aggr_keys[PROBE_BLOCK];
+	size_t beg, end, o, m, matches;
+	int q;
+	while (morsel_next(&multi->cursor, &beg, &end)) {
+		for (o = beg; o < end; o += PROBE_BLOCK) {
+			size_t n = end - o < PROBE_BLOCK ? end - o : PROBE_BLOCK;
+			matches = probe->block(index->table, index->log_buckets,
+					       &multi->outer_keys[o], n,
+					       sel, prices);
+			/*gather the matching orders once for all queries*/
+			for (m = 0; m != matches; ++m)
+				quantities[m] = multi->outer_vals[o + sel[m]];
+			if (multi->grouped)
+				for (m = 0; m != matches; ++m)
+					aggr_keys[m] =
+						multi->outer_aggr_keys[o + sel[m]];
+			for (q = 0; q != multi->n_queries; ++q)
+				multi_aggregate(multi, thread, q, matches,
+						prices, quantities, aggr_keys);
+		}
+	}
+}
+
+/* merge the group tables of all threads for query q and average them */
+static void multi_result(multi_t *multi, int threads, int q)
+{
+	q4112_query_t *query = &multi->queries[q];
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	size_t i, used = 0;
+	int t;
+	query->tuples = 0;
+	for (t = 0; t != threads; ++t) {
+		size_t slot = (size_t) t * multi->n_queries + q;
+		sum += multi->sums[slot];
+		query->tuples += multi->counts[slot];
+		if (query->grouped)
+			used += multi->groups[slot].used;
+	}
+	if (!query->grouped) {
+		query->result = query->tuples ?
+			(uint64_t) (sum / query->tuples) : 0;
+		query->groups = 0;
+		return;
+	}
+	aggr_table_t merged;
+	int8_t log_buckets = LOG_GROUP_BUCKETS;
+	while ((((size_t) 1) << log_buckets) * 0.67 < used)
+		log_buckets++;
+	aggr_table_init(&merged, log_buckets);
+	for (t = 0; t != threads; ++t) {
+		const aggr_table_t *groups =
+			&multi->groups[(size_t) t * multi->n_queries + q];
+		for (i = 0; i != groups->buckets; ++i)
+			if (groups->table[i].aggr_key != 0)
+				aggr_table_update(&merged,
+						  groups->table[i].aggr_key,
+						  groups->table[i].count,
+						  aggr_bucket_sum(&groups->table[i]));
+	}
+	sum = 0;
+	for (i = 0; i != merged.buckets; ++i) {
+		if (merged.table[i].aggr_key != 0 &&
+		    merged.table[i].count > 0) {
+			sum += aggr_bucket_sum(&merged.table[i]) /
+				merged.table[i].count;
+			count += 1;
+		}
+	}
+	query->result = count ? (uint64_t) (sum / count) : 0;
+	query->groups = merged.used;
+	aggr_table_free(&merged);
+}
+
+void q4112_run_multi(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		     size_t inner_tuples, const uint32_t *outer_join_keys,
+		     const uint32_t *outer_aggr_keys,
+		     const uint32_t *outer_vals, size_t outer_tuples,
+		     q4112_query_t *queries, int n_queries, int threads)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	size_t slots = (size_t) threads * n_queries, s;
+	int q;
+	multi_t multi;
+	multi.grouped = 0;
+	for (q = 0; q != n_queries; ++q) {
+		assert(queries[q].quantity_min <= queries[q].quantity_max);
+		assert(queries[q].price_min <= queries[q].price_max);
+		multi.grouped |= queries[q].grouped;
+	}
+	assert(outer_aggr_keys != NULL || !multi.grouped);
+
+	q4112_index_t *index = index_build(inner_keys, inner_vals,
+					   inner_tuples, threads);
+	multi.index = index;
+	multi.outer_keys = outer_join_keys;
+	multi.outer_aggr_keys = outer_aggr_keys;
+	multi.outer_vals = outer_vals;
+	multi.queries = queries;
+	multi.n_queries = n_queries;
+	multi.groups = (aggr_table_t *) calloc(slots, sizeof(aggr_table_t));
+	multi.sums = (aggr_sum_t *) calloc(slots, sizeof(aggr_sum_t));
+	multi.counts = (uint64_t *) calloc(slots, sizeof(uint64_t));
+	assert(multi.groups != NULL);
+	assert(multi.sums != NULL && multi.counts != NULL);
+	for (s = 0; s != slots; ++s)
+		if (queries[s % n_queries].grouped)
+			aggr_table_init(&multi.groups[s], LOG_GROUP_BUCKETS);
+	morsel_init(&multi.cursor, 0, outer_tuples);
+
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_run(pool, multi_thread, &multi);
+	pool_release(pool);
+
+	for (q = 0; q != n_queries; ++q)
+		multi_result(&multi, threads, q);
+	for (s = 0; s != slots; ++s)
+		if (queries[s % n_queries].grouped)
+			aggr_table_free(&multi.groups[s]);
+	free(multi.groups);
+	free(multi.sums);
+	free(multi.counts);
+	index_free(index);
+}
@@ -0,0 +1,39 @@
+#ifndef _Q4112_MULTI_
+#define _Q4112_MULTI_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * one query of a shared scan: the average of items.price *
+ * orders.quantity over the joined orders with both values in their
+ * (inclusive) ranges, as q4112_run computes it; grouped by
+ * orders.store_id or global
+ */
+typedef struct {
+	int grouped;
+	uint32_t quantity_min;
+	uint32_t quantity_max;
+	uint32_t price_min;
+	uint32_t price_max;
+	/* set by q4112_run_multi */
+	uint64_t result;
+	uint64_t tuples;
+	size_t groups;
+} q4112_query_t;
+
+/* the query without filters */
+void query_init(q4112_query_t *query, int grouped);
+
+/*
+ * run a batch of queries in one pass: the items are hashed once, every
+ * order is probed once and the match is fed to the aggregation of each
+ * query it passes; outer_aggr_keys may be NULL if no query is grouped
+ */
+void q4112_run_multi(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		     size_t inner_tuples, const uint32_t *outer_join_keys,
+		     const uint32_t *outer_aggr_keys,
+		     const uint32_t *outer_vals, size_t outer_tuples,
+		     q4112_query_t *queries, int n_queries, int threads);
+
+#endif
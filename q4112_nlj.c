@@ -1,87 +1,403 @@
 #include <assert.h>
-#include <pthread.h>
+#include <immintrin.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "q4112_aggr.h"
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+
+/* outer keys joined per step against every tile of the inner table */
+#define NLJ_BLOCK 1024
+/* inner tuples per tile: its keys and values (16KB) stay in L1 */
+#define NLJ_TILE 2048
+/*
+ * a group of 64 outer keys matches about 64 keys of a tile; with tiles
+ * of up to this many keys the match branch is mispredicted so often
+ * that the kernels take the masked moves unconditionally
+ */
+#define NLJ_SPARSE 512
+/* initial group table of every thread; it grows when needed */
+#define LOG_GROUP_BUCKETS 10
+
+/*
+ * join keys[0..n) against the inner table; for every match write the
+ * position in keys to sel and the inner value to vals (ascending sel);
+ * keys has room for NLJ_BLOCK keys, the kernels may pad it with 0 keys
+ * (no inner key is 0, see q4112.h)
+ */
+typedef size_t (*nlj_kernel_t)(const uint32_t *inner_keys,
+			       const uint32_t *inner_vals, size_t inner_tuples,
+			       uint32_t *keys, size_t n,
+			       uint32_t *sel, uint32_t *vals);
+
 typedef struct {
-	pthread_t id;
-	int thread;
-	int threads;
+	const uint32_t *inner_keys;
+	const uint32_t *inner_vals;
 	size_t inner_tuples;
-	size_t outer_tuples;
-	const uint32_t* inner_keys;
-	const uint32_t* inner_vals;
-	const uint32_t* outer_keys;
-	const uint32_t* outer_vals;
-	uint64_t sum;
-	uint32_t count;
-} q4112_run_info_t;
+	const uint32_t *outer_keys;
+	const uint32_t *outer_aggr_keys;
+	const uint32_t *outer_vals;
+	nlj_kernel_t kernel;
+	/* partial results of every thread */
+	aggr_table_t *groups;
+	aggr_sum_t *sums;
+	uint64_t *counts;
+	morsel_cursor_t cursor;
+} nlj_t;
 
-void* q4112_run_thread(void* arg) {
-	q4112_run_info_t* info = (q4112_run_info_t*) arg;
-	assert(pthread_equal(pthread_self(), info->id));
-	// copy info
-	size_t thread  = info->thread;
-	size_t threads = info->threads;
-	size_t inner_tuples = info->inner_tuples;
-	size_t outer_tuples = info->outer_tuples;
-	const uint32_t* inner_keys = info->inner_keys;
-	const uint32_t* inner_vals = info->inner_vals;
-	const uint32_t* outer_keys = info->outer_keys;
-	const uint32_t* outer_vals = info->outer_vals;
-	// thread boundaries for outer table
-	size_t outer_beg = (outer_tuples / threads) * (thread + 0);
-	size_t outer_end = (outer_tuples / threads) * (thread + 1);
-	if (thread + 1 == threads) outer_end = outer_tuples;
-	// initialize aggregate
-	uint64_t sum = 0;
-	uint32_t count = 0;
-	// scan whole inner table but split outer table
-	size_t i, o;
-	for (o = outer_beg; o != outer_end; ++o) {
+/* the inner keys are unique, so an outer key stops at its match */
+static size_t nlj_block_scalar(const uint32_t *inner_keys,
+			       const uint32_t *inner_vals, size_t inner_tuples,
+			       uint32_t *keys, size_t n,
+			       uint32_t *sel, uint32_t *vals)
+{
+	size_t o, i, m = 0;
+	for (o = 0; o != n; ++o) {
 		for (i = 0; i != inner_tuples; ++i) {
-			if (inner_keys[i] == outer_keys[o]) {
-				sum += inner_vals[i] * (uint64_t) outer_vals[o];
-				count += 1;
+			if (inner_keys[i] == keys[o]) {
+				sel[m] = o;
+				vals[m++] = inner_vals[i];
+				break;
+			}
+		}
+	}
+	return m;
+}
+
+/*
+ * one group of 4 registers of 8 outer keys against inner keys [beg,
+ * end): the broadcast inner key is compared to all 32 lanes and the
+ * group stops once all its lanes matched; sparse (a constant) skips
+ * the blends unless the OR of the compares has a match
+ */
+__attribute__((target("avx2"), always_inline))
+static inline void nlj_group_avx2(const uint32_t *inner_keys,
+				  const uint32_t *inner_vals,
+				  size_t beg, size_t end,
+				  const uint32_t *keys, __m256i *hit,
+				  __m256i *val, int sparse)
+{
+	const __m256i *outer = (const __m256i *) keys;
+	const __m256i all = _mm256_set1_epi32(-1);
+	__m256i k0 = _mm256_loadu_si256(&outer[0]);
+	__m256i k1 = _mm256_loadu_si256(&outer[1]);
+	__m256i k2 = _mm256_loadu_si256(&outer[2]);
+	__m256i k3 = _mm256_loadu_si256(&outer[3]);
+	__m256i v0 = val[0], v1 = val[1], v2 = val[2], v3 = val[3];
+	__m256i h0 = hit[0], h1 = hit[1], h2 = hit[2], h3 = hit[3];
+	size_t i;
+	if (_mm256_testc_si256(_mm256_and_si256(_mm256_and_si256(h0, h1),
+						_mm256_and_si256(h2, h3)),
+			       all))
+		return;
+	for (i = beg; i != end; ++i) {
+		__m256i key = _mm256_set1_epi32(inner_keys[i]);
+		__m256i e0 = _mm256_cmpeq_epi32(k0, key);
+		__m256i e1 = _mm256_cmpeq_epi32(k1, key);
+		__m256i e2 = _mm256_cmpeq_epi32(k2, key);
+		__m256i e3 = _mm256_cmpeq_epi32(k3, key);
+		if (sparse) {
+			__m256i any = _mm256_or_si256(_mm256_or_si256(e0, e1),
+						      _mm256_or_si256(e2, e3));
+			if (_mm256_testz_si256(any, any))
+				continue;
+		}
+		__m256i in = _mm256_set1_epi32(inner_vals[i]);
+		v0 = _mm256_blendv_epi8(v0, in, e0);
+		v1 = _mm256_blendv_epi8(v1, in, e1);
+		v2 = _mm256_blendv_epi8(v2, in, e2);
+		v3 = _mm256_blendv_epi8(v3, in, e3);
+		h0 = _mm256_or_si256(h0, e0);
+		h1 = _mm256_or_si256(h1, e1);
+		h2 = _mm256_or_si256(h2, e2);
+		h3 = _mm256_or_si256(h3, e3);
+		if (_mm256_testc_si256(
+			    _mm256_and_si256(_mm256_and_si256(h0, h1),
+					     _mm256_and_si256(h2, h3)),
+			    all))
+			break;
+	}
+	val[0] = v0;
+	val[1] = v1;
+	val[2] = v2;
+	val[3] = v3;
+	hit[0] = h0;
+	hit[1] = h1;
+	hit[2] = h2;
+	hit[3] = h3;
+}
+
+/*
+ * blocks of 32 outer keys against L1 tiles of the inner table; the
+ * matched lanes are found with movemask
+ */
+__attribute__((target("avx2")))
+static size_t nlj_block_avx2(const uint32_t *inner_keys,
+			     const uint32_t *inner_vals, size_t inner_tuples,
+			     uint32_t *keys, size_t n,
+			     uint32_t *sel, uint32_t *vals)
+{
+	__m256i hit[NLJ_BLOCK / 8];
+	__m256i val[NLJ_BLOCK / 8];
+	uint32_t lanes[8];
+	size_t vectors = (n + 31) / 32 * 4, v, t, i, m = 0;
+	for (i = n; i != vectors * 8; ++i)
+		keys[i] = 0;
+	for (v = 0; v != vectors; ++v)
+		hit[v] = val[v] = _mm256_setzero_si256();
+	for (t = 0; t < inner_tuples; t += NLJ_TILE) {
+		size_t end = inner_tuples - t < NLJ_TILE ?
+			inner_tuples : t + NLJ_TILE;
+		for (v = 0; v != vectors; v += 4) {
+			if (end - t > NLJ_SPARSE)
+				nlj_group_avx2(inner_keys, inner_vals, t, end,
+					       &keys[v * 8], &hit[v], &val[v],
+					       1);
+			else
+				nlj_group_avx2(inner_keys, inner_vals, t, end,
+					       &keys[v * 8], &hit[v], &val[v],
+					       0);
+		}
+	}
+	for (v = 0; v != vectors; ++v) {
+		/*the padding lanes of the last registers never match*/
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit[v]));
+		_mm256_storeu_si256((__m256i *) lanes, val[v]);
+		while (mask != 0) {
+			int l = __builtin_ctz(mask);
+			sel[m] = v * 8 + l;
+			vals[m++] = lanes[l];
+			mask &= mask - 1;
+		}
+	}
+	return m;
+}
+
+/*
+ * one group of 4 registers of 16 outer keys against inner keys [beg,
+ * end); sparse (a constant) branches off on the matches, which pays
+ * only when few inner keys hit one of the 64 outer keys
+ */
+__attribute__((target("avx512f"), always_inline))
+static inline void nlj_group_avx512(const uint32_t *inner_keys,
+				    const uint32_t *inner_vals,
+				    size_t beg, size_t end,
+				    const uint32_t *keys, __mmask16 *hit,
+				    __m512i *val, int sparse)
+{
+	__m512i k0 = _mm512_loadu_si512(&keys[0]);
+	__m512i k1 = _mm512_loadu_si512(&keys[16]);
+	__m512i k2 = _mm512_loadu_si512(&keys[32]);
+	__m512i k3 = _mm512_loadu_si512(&keys[48]);
+	__m512i v0 = val[0], v1 = val[1], v2 = val[2], v3 = val[3];
+	__mmask16 h0 = hit[0], h1 = hit[1], h2 = hit[2], h3 = hit[3];
+	size_t i;
+	if ((h0 & h1 & h2 & h3) == 0xFFFF)
+		return;
+	for (i = beg; i != end; ++i) {
+		__m512i key = _mm512_set1_epi32(inner_keys[i]);
+		__mmask16 e0 = _mm512_cmpeq_epi32_mask(k0, key);
+		__mmask16 e1 = _mm512_cmpeq_epi32_mask(k1, key);
+		__mmask16 e2 = _mm512_cmpeq_epi32_mask(k2, key);
+		__mmask16 e3 = _mm512_cmpeq_epi32_mask(k3, key);
+		if (sparse && (e0 | e1 | e2 | e3) == 0)
+			continue;
+		__m512i in = _mm512_set1_epi32(inner_vals[i]);
+		v0 = _mm512_mask_mov_epi32(v0, e0, in);
+		v1 = _mm512_mask_mov_epi32(v1, e1, in);
+		v2 = _mm512_mask_mov_epi32(v2, e2, in);
+		v3 = _mm512_mask_mov_epi32(v3, e3, in);
+		h0 |= e0;
+		h1 |= e1;
+		h2 |= e2;
+		h3 |= e3;
+		if ((h0 & h1 & h2 & h3) == 0xFFFF)
+			break;
+	}
+	val[0] = v0;
+	val[1] = v1;
+	val[2] = v2;
+	val[3] = v3;
+	hit[0] = h0;
+	hit[1] = h1;
+	hit[2] = h2;
+	hit[3] = h3;
+}
+
+/* the same with 4 registers of 16 outer keys and mask registers */
+__attribute__((target("avx512f")))
+static size_t nlj_block_avx512(const uint32_t *inner_keys,
+			       const uint32_t *inner_vals, size_t inner_tuples,
+			       uint32_t *keys, size_t n,
+			       uint32_t *sel, uint32_t *vals)
+{
+	__mmask16 hit[NLJ_BLOCK / 16];
+	__m512i val[NLJ_BLOCK / 16];
+	const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+						8, 9, 10, 11, 12, 13, 14, 15);
+	size_t vectors = (n + 63) / 64 * 4, v, t, i, m = 0;
+	for (i = n; i != vectors * 16; ++i)
+		keys[i] = 0;
+	for (v = 0; v != vectors; ++v) {
+		hit[v] = 0;
+		val[v] = _mm512_setzero_si512();
+	}
+	for (t = 0; t < inner_tuples; t += NLJ_TILE) {
+		size_t end = inner_tuples - t < NLJ_TILE ?
+			inner_tuples : t + NLJ_TILE;
+		for (v = 0; v != vectors; v += 4) {
+			if (end - t > NLJ_SPARSE)
+				nlj_group_avx512(inner_keys, inner_vals, t, end,
+						 &keys[v * 16], &hit[v],
+						 &val[v], 1);
+			else
+				nlj_group_avx512(inner_keys, inner_vals, t, end,
+						 &keys[v * 16], &hit[v],
+						 &val[v], 0);
+		}
+	}
+	for (v = 0; v != vectors; ++v) {
+		/*the padding lanes of the last register never match*/
+		_mm512_mask_compressstoreu_epi32(&sel[m], hit[v],
+			_mm512_add_epi32(lanes, _mm512_set1_epi32(v * 16)));
+		_mm512_mask_compressstoreu_epi32(&vals[m], hit[v], val[v]);
+		m += __builtin_popcount(hit[v]);
+	}
+	return m;
+}
+
+static void nlj_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	nlj_t *nlj = (nlj_t *) arg;
+	uint32_t keys[NLJ_BLOCK];
+	uint32_t sel[NLJ_BLOCK];
+	uint32_t vals[NLJ_BLOCK];
+	size_t beg, end, o, m, matches;
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	while (morsel_next(&nlj->cursor, &beg, &end)) {
+		for (o = beg; o < end; o += NLJ_BLOCK) {
+			size_t n = end - o < NLJ_BLOCK ? end - o : NLJ_BLOCK;
+			memcpy(keys, &nlj->outer_keys[o], n * sizeof(uint32_t));
+			matches = nlj->kernel(nlj->inner_keys, nlj->inner_vals,
+					      nlj->inner_tuples, keys, n,
+					      sel, vals);
+			count += matches;
+			if (nlj->outer_aggr_keys != NULL) {
+				for (m = 0; m != matches; ++m)
+					aggr_table_update(
+						&nlj->groups[thread],
+						nlj->outer_aggr_keys[o + sel[m]],
+						1, vals[m] * (uint64_t)
+						nlj->outer_vals[o + sel[m]]);
+				continue;
 			}
+			for (m = 0; m != matches; ++m)
+				sum += vals[m] *
+					(uint64_t) nlj->outer_vals[o + sel[m]];
 		}
 	}
-	info->sum = sum;
-	info->count = count;
-	pthread_exit(NULL);
+	nlj->sums[thread] = sum;
+	nlj->counts[thread] = count;
 }
 
-uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
-		   size_t inner_tuples, const uint32_t* outer_join_keys,
-		   const uint32_t* outer_aggr_keys, const uint32_t* outer_vals,
-		   size_t outer_tuples, int threads) {
-	// check number of threads
+/* merge the group tables of all threads and average them */
+static uint64_t nlj_grouped_result(nlj_t *nlj, int threads)
+{
+	aggr_table_t merged;
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	size_t i, used = 0;
+	int8_t log_buckets = LOG_GROUP_BUCKETS;
+	int t;
+	for (t = 0; t != threads; ++t)
+		used += nlj->groups[t].used;
+	while ((((size_t) 1) << log_buckets) * 0.67 < used)
+		log_buckets++;
+	aggr_table_init(&merged, log_buckets);
+	for (t = 0; t != threads; ++t) {
+		const aggr_table_t *groups = &nlj->groups[t];
+		for (i = 0; i != groups->buckets; ++i)
+			if (groups->table[i].aggr_key != 0)
+				aggr_table_update(&merged,
+						  groups->table[i].aggr_key,
+						  groups->table[i].count,
+						  aggr_bucket_sum(&groups->table[i]));
+	}
+	for (i = 0; i != merged.buckets; ++i) {
+		if (merged.table[i].aggr_key != 0 &&
+		    merged.table[i].count > 0) {
+			sum += aggr_bucket_sum(&merged.table[i]) /
+				merged.table[i].count;
+			count += 1;
+		}
+	}
+	aggr_table_free(&merged);
+	return count ? (uint64_t) (sum / count) : 0;
+}
+
+/*
+ * blocked nested loop join for small inner tables: every morsel of the
+ * outer table is joined in blocks against L1 sized tiles of the inner
+ * table with the widest SIMD kernel (Q4112_SIMD as for the probes)
+ */
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
 	int t, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
 	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
-	// run threads
-	q4112_run_info_t* info = (q4112_run_info_t*)
-		malloc(threads * sizeof(q4112_run_info_t));
-	assert(info != NULL);
-	for (t = 0; t != threads; ++t) {
-		info[t].thread = t;
-		info[t].threads = threads;
-		info[t].inner_keys = inner_keys;
-		info[t].inner_vals = inner_vals;
-		info[t].outer_keys = outer_join_keys;
-		info[t].outer_vals = outer_vals;
-		info[t].inner_tuples = inner_tuples;
-		info[t].outer_tuples = outer_tuples;
-		pthread_create(&info[t].id, NULL, q4112_run_thread, &info[t]);
+	nlj_t nlj;
+	nlj.inner_keys = inner_keys;
+	nlj.inner_vals = inner_vals;
+	nlj.inner_tuples = inner_tuples;
+	nlj.outer_keys = outer_join_keys;
+	nlj.outer_aggr_keys = outer_aggr_keys;
+	nlj.outer_vals = outer_vals;
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		nlj.kernel = nlj_block_avx512;
+		break;
+	case SIMD_AVX2:
+		nlj.kernel = nlj_block_avx2;
+		break;
+	default:
+		nlj.kernel = nlj_block_scalar;
 	}
-	// gather result
-	uint64_t sum = 0;
-	uint32_t count = 0;
-	for (t = 0; t != threads; ++t) {
-		pthread_join(info[t].id, NULL);
-		sum += info[t].sum;
-		count += info[t].count;
+	nlj.groups = (aggr_table_t *) calloc(threads, sizeof(aggr_table_t));
+	nlj.sums = (aggr_sum_t *) calloc(threads, sizeof(aggr_sum_t));
+	nlj.counts = (uint64_t *) calloc(threads, sizeof(uint64_t));
+	assert(nlj.groups != NULL);
+	assert(nlj.sums != NULL && nlj.counts != NULL);
+	if (outer_aggr_keys != NULL)
+		for (t = 0; t != threads; ++t)
+			aggr_table_init(&nlj.groups[t], LOG_GROUP_BUCKETS);
+	morsel_init(&nlj.cursor, 0, outer_tuples);
+
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_run(pool, nlj_thread, &nlj);
+	pool_release(pool);
+
+	uint64_t res;
+	if (outer_aggr_keys != NULL) {
+		res = nlj_grouped_result(&nlj, threads);
+		for (t = 0; t != threads; ++t)
+			aggr_table_free(&nlj.groups[t]);
+	} else {
+		aggr_sum_t sum = 0;
+		uint64_t count = 0;
+		for (t = 0; t != threads; ++t) {
+			sum += nlj.sums[t];
+			count += nlj.counts[t];
+		}
+		res = count ? (uint64_t) (sum / count) : 0;
 	}
-	free(info);
-	return sum / count;
+	free(nlj.groups);
+	free(nlj.sums);
+	free(nlj.counts);
+	return res;
 }
@@ -7,8 +7,8 @@ uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
 		   const uint32_t* outer_aggr_keys, const uint32_t* outer_vals,
 		   size_t outer_tuples, int threads) {
   assert(threads == 1);
-  uint64_t sum = 0;
-  uint32_t count = 0;
+  unsigned __int128 sum = 0;
+  uint64_t count = 0;
   size_t i, o;
   for (o = 0; o != outer_tuples; ++o) {
     for (i = 0; i != inner_tuples; ++i) {
@@ -19,5 +19,5 @@ uint64_t q4112_run(const uint32_t* inner_keys, const uint32_t* inner_vals,
       }
     }
   }
-  return sum / count;
+  return (uint64_t) (sum / count);
 }
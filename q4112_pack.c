@@ -0,0 +1,154 @@
+#include <assert.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q4112_pack.h"
+#include "q4112_probe.h"
+
+/*
+ * the gather kernels read every field with one 32-bit load at a byte
+ * offset, so the field plus its bit shift (up to 7) must fit in 32 bits;
+ * wider fields are unpacked by the scalar loop
+ */
+#define SIMD_MAX_BITS 25
+/* padding after the bit stream for the unaligned 8 byte loads */
+#define PACK_PADDING 8
+
+void pack_column(packed_column_t *col, const uint32_t *values, size_t n)
+{
+	uint32_t min = UINT32_MAX, max = 0;
+	size_t i;
+	for (i = 0; i != n; ++i) {
+		min = values[i] < min ? values[i] : min;
+		max = values[i] > max ? values[i] : max;
+	}
+	if (n == 0)
+		min = max = 0;
+	col->base = min;
+	col->bits = max == min ? 0 : 32 - __builtin_clz(max - min);
+	col->tuples = n;
+	col->data = (uint8_t *) calloc(pack_bytes(col), 1);
+	assert(col->data != NULL);
+
+	size_t bit = 0;
+	for (i = 0; i != n; ++i, bit += col->bits) {
+		uint64_t word;
+		memcpy(&word, &col->data[bit >> 3], sizeof(word));
+		word |= ((uint64_t) (values[i] - min)) << (bit & 7);
+		memcpy(&col->data[bit >> 3], &word, sizeof(word));
+	}
+}
+
+void pack_free(packed_column_t *col)
+{
+	free(col->data);
+	col->data = NULL;
+}
+
+size_t pack_bytes(const packed_column_t *col)
+{
+	return (col->tuples * col->bits + 7) / 8 + PACK_PADDING;
+}
+
+static void unpack_scalar(const packed_column_t *col, size_t beg, size_t n,
+			  uint32_t *out)
+{
+	uint64_t mask = (((uint64_t) 1) << col->bits) - 1;
+	size_t i, bit = beg * col->bits;
+	for (i = 0; i != n; ++i, bit += col->bits) {
+		uint64_t word;
+		memcpy(&word, &col->data[bit >> 3], sizeof(word));
+		out[i] = col->base + (uint32_t) ((word >> (bit & 7)) & mask);
+	}
+}
+
+/*
+ * 8 fields per step: lane l starts at bit (bit & 7) + l * bits of the
+ * byte holding the first one, so the gather offsets stay small whatever
+ * the size of the column
+ */
+__attribute__((target("avx2")))
+static void unpack_avx2(const packed_column_t *col, size_t beg, size_t n,
+			uint32_t *out)
+{
+	int bits = col->bits;
+	const __m256i lanes = _mm256_mullo_epi32(
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+		_mm256_set1_epi32(bits));
+	const __m256i mask = _mm256_set1_epi32((1u << bits) - 1);
+	const __m256i base = _mm256_set1_epi32(col->base);
+	const __m256i seven = _mm256_set1_epi32(7);
+	size_t i = 0, bit = beg * bits;
+	for (; i + 8 <= n; i += 8, bit += 8 * bits) {
+		const int *first = (const int *) &col->data[bit >> 3];
+		__m256i off = _mm256_add_epi32(lanes,
+					       _mm256_set1_epi32(bit & 7));
+		__m256i word = _mm256_i32gather_epi32(first,
+						      _mm256_srli_epi32(off, 3),
+						      1);
+		word = _mm256_srlv_epi32(word, _mm256_and_si256(off, seven));
+		word = _mm256_add_epi32(_mm256_and_si256(word, mask), base);
+		_mm256_storeu_si256((__m256i *) &out[i], word);
+	}
+	unpack_scalar(col, beg + i, n - i, &out[i]);
+}
+
+/* the same with 16 fields per step */
+__attribute__((target("avx512f")))
+static void unpack_avx512(const packed_column_t *col, size_t beg, size_t n,
+			  uint32_t *out)
+{
+	int bits = col->bits;
+	const __m512i lanes = _mm512_mullo_epi32(
+		_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+				  8, 9, 10, 11, 12, 13, 14, 15),
+		_mm512_set1_epi32(bits));
+	const __m512i mask = _mm512_set1_epi32((1u << bits) - 1);
+	const __m512i base = _mm512_set1_epi32(col->base);
+	const __m512i seven = _mm512_set1_epi32(7);
+	size_t i = 0, bit = beg * bits;
+	for (; i + 16 <= n; i += 16, bit += 16 * bits) {
+		const void *first = &col->data[bit >> 3];
+		__m512i off = _mm512_add_epi32(lanes,
+					       _mm512_set1_epi32(bit & 7));
+		__m512i word = _mm512_i32gather_epi32(_mm512_srli_epi32(off, 3),
+						      first, 1);
+		word = _mm512_srlv_epi32(word, _mm512_and_si512(off, seven));
+		word = _mm512_add_epi32(_mm512_and_si512(word, mask), base);
+		_mm512_storeu_si512(&out[i], word);
+	}
+	unpack_scalar(col, beg + i, n - i, &out[i]);
+}
+
+void unpack_block(const packed_column_t *col, size_t beg, size_t n,
+		  uint32_t *out)
+{
+	assert(beg + n <= col->tuples);
+	if (col->bits == 32) {
+		/*nothing packed, a copy the compiler vectorizes*/
+		size_t i;
+		const uint8_t *data = &col->data[beg * sizeof(uint32_t)];
+		for (i = 0; i != n; ++i) {
+			uint32_t word;
+			memcpy(&word, &data[i * sizeof(uint32_t)], sizeof(word));
+			out[i] = col->base + word;
+		}
+		return;
+	}
+	if (col->bits > SIMD_MAX_BITS) {
+		unpack_scalar(col, beg, n, out);
+		return;
+	}
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		unpack_avx512(col, beg, n, out);
+		break;
+	case SIMD_AVX2:
+		unpack_avx2(col, beg, n, out);
+		break;
+	default:
+		unpack_scalar(col, beg, n, out);
+	}
+}
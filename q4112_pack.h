@@ -0,0 +1,58 @@
+#ifndef _Q4112_PACK_
+#define _Q4112_PACK_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * frame of reference + bit packing: value i is base plus the bits wide
+ * field at bit i * bits of a little endian bit stream (padded so that
+ * any field can be read with one unaligned 8 byte load)
+ */
+typedef struct {
+	uint32_t base;
+	int bits;
+	size_t tuples;
+	uint8_t *data;
+} packed_column_t;
+
+/* pack values with the fewest bits for their range (max - min) */
+void pack_column(packed_column_t *col, const uint32_t *values, size_t n);
+
+void pack_free(packed_column_t *col);
+
+/* bytes of the packed column, padding included */
+size_t pack_bytes(const packed_column_t *col);
+
+/* unpack values [beg, beg + n) to out (AVX2/AVX-512 gathers) */
+void unpack_block(const packed_column_t *col, size_t beg, size_t n,
+		  uint32_t *out);
+
+/*
+ * outer column of a query, plain or packed; blocks are read through
+ * column_block so that the join loops do not care which
+ */
+typedef struct {
+	const uint32_t *plain;
+	const packed_column_t *packed;
+} column_t;
+
+/* values [beg, beg + n) of col, unpacked to buf if col is packed */
+static inline const uint32_t *column_block(const column_t *col, size_t beg,
+					   size_t n, uint32_t *buf)
+{
+	if (col->packed == NULL)
+		return &col->plain[beg];
+	unpack_block(col->packed, beg, n, buf);
+	return buf;
+}
+
+/* the hash join of q4112_run on packed orders columns */
+uint64_t q4112_run_packed(const uint32_t *inner_keys,
+			  const uint32_t *inner_vals, size_t inner_tuples,
+			  const packed_column_t *outer_join_keys,
+			  const packed_column_t *outer_aggr_keys,
+			  const packed_column_t *outer_vals,
+			  size_t outer_tuples, int threads);
+
+#endif
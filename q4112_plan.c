@@ -0,0 +1,248 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "q4112.h"
+#include "q4112_aggr.h"
+#include "q4112_dense.h"
+#include "q4112_hll.h"
+#include "q4112_mem.h"
+#include "q4112_plan.h"
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+
+/* outer tuples sketched for the group estimate (evenly spaced) */
+#define PLAN_SAMPLE (1 << 16)
+/* cache sizes when sysconf does not know them */
+#define DEFAULT_L2_BYTES (256 << 10)
+#define DEFAULT_LLC_BYTES (8 << 20)
+
+/*
+ * nanoseconds per tuple on one core, fitted to single threaded runs of
+ * the engines; only their ratios matter to the plan
+ */
+#define NS_COMPARE 1.5
+#define NS_L2_ACCESS 4.0
+#define NS_LLC_ACCESS 15.0
+#define NS_DRAM_ACCESS 30.0
+/* one radix pass: histogram and scatter of a tuple */
+#define NS_PARTITION 8.0
+/* one LSB radix sort pass over a tuple and the merge join step */
+#define NS_SORT_PASS 12.0
+#define NS_MERGE 10.0
+/* hand over a private group to the merge */
+#define NS_EXCHANGE 4.0
+/* engines without the pool create their threads on every call */
+#define NS_THREAD_START 50000.0
+
+static const char *const plan_names[PLANS] = {
+	"nlj", "hj_1", "hj", "radix", "smj"
+};
+
+const char *plan_name(int engine)
+{
+	return plan_names[engine];
+}
+
+/* cost of one random access into a structure of the given size */
+static double access_ns(size_t bytes, size_t l2, size_t llc)
+{
+	if (bytes <= l2)
+		return NS_L2_ACCESS;
+	if (bytes <= llc)
+		return NS_LLC_ACCESS;
+	return NS_DRAM_ACCESS;
+}
+
+/* buckets of a linear probing table at the fill rate of the engines */
+static size_t table_buckets(size_t tuples)
+{
+	size_t buckets = 2;
+	while (buckets * 0.67 < tuples)
+		buckets += buckets;
+	return buckets;
+}
+
+static double estimate_groups(const uint32_t *outer_aggr_keys,
+			      size_t outer_tuples)
+{
+	if (outer_aggr_keys == NULL)
+		return 0;
+	size_t i, samples = outer_tuples < PLAN_SAMPLE ?
+		outer_tuples : PLAN_SAMPLE;
+	hll_t sketch;
+	hll_init(&sketch);
+	for (i = 0; i != samples; ++i)
+		hll_add(&sketch, outer_aggr_keys[i * (outer_tuples / samples)]);
+	double groups = hll_estimate(&sketch);
+	/* same extrapolation as the hash join: a sample that repeats its
+	 * groups has seen most of them
+	 */
+	if (samples < outer_tuples && groups * 4 > samples)
+		groups *= sqrt((double) outer_tuples / samples);
+	return groups < outer_tuples ? groups : outer_tuples;
+}
+
+void plan_query(q4112_plan_t *plan, const uint32_t *inner_keys,
+		size_t inner_tuples, const uint32_t *outer_aggr_keys,
+		size_t outer_tuples, int threads)
+{
+	size_t l2 = mem_cache_bytes(_SC_LEVEL2_CACHE_SIZE, DEFAULT_L2_BYTES);
+	size_t llc = mem_cache_bytes(_SC_LEVEL3_CACHE_SIZE, DEFAULT_LLC_BYTES);
+	memset(plan, 0, sizeof(*plan));
+
+	/*statistics*/
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_key_range(pool, inner_keys, inner_tuples, &plan->key_min,
+		       &plan->key_max);
+	pool_release(pool);
+	plan->groups = estimate_groups(outer_aggr_keys, outer_tuples);
+	/* the hash joins index an array instead when the keys are dense */
+	plan->dense = dense_worth(plan->key_min, plan->key_max,
+				  table_buckets(inner_tuples));
+	plan->table_bytes = plan->dense ?
+		dense_bytes(plan->key_min, plan->key_max) :
+		table_buckets(inner_tuples) * sizeof(bucket_t);
+	size_t group_bytes = table_buckets(plan->groups) *
+		sizeof(aggr_bucket_t);
+
+	/* matches are bounded by the outer tuples; the selectivity is not
+	 * known before the join
+	 */
+	double probe = access_ns(plan->table_bytes, l2, llc);
+	double aggr = outer_aggr_keys ? access_ns(group_bytes, l2, llc) : 0;
+	double join = inner_tuples * probe + outer_tuples * (probe + aggr);
+
+	/* the blocked nested loop compares a SIMD register of outer keys
+	 * at a time and aggregates like a probe; hj_1 only computes the
+	 * global average and always runs on one thread
+	 */
+	int lanes = simd_level() == SIMD_AVX512 ? 16 :
+		simd_level() == SIMD_AVX2 ? 8 : 1;
+	plan->cost[PLAN_NLJ] = outer_tuples *
+		(inner_tuples * NS_COMPARE / lanes + aggr) / threads;
+	plan->cost[PLAN_HJ_1] = outer_aggr_keys ? -1 : join;
+	plan->cost[PLAN_HJ] = join / threads;
+	/* partitions of about 4K tuples are joined in L2; more than 6 radix
+	 * bits take a second pass
+	 */
+	int passes = inner_tuples > ((size_t) 4096 << 6) ? 2 : 1;
+	double part_aggr = outer_aggr_keys ?
+		outer_tuples * access_ns(group_bytes / threads, l2, llc) +
+		plan->groups * threads * NS_EXCHANGE : 0;
+	plan->cost[PLAN_RADIX] = ((inner_tuples + outer_tuples) *
+				  (passes * NS_PARTITION + NS_L2_ACCESS) +
+				  part_aggr) / threads +
+		threads * NS_THREAD_START;
+	/* four 8-bit passes per sort; the joined tuples are sorted on the
+	 * group as well, no random access at all
+	 */
+	plan->cost[PLAN_SMJ] = ((inner_tuples + outer_tuples) *
+				(4 * NS_SORT_PASS + NS_MERGE) +
+				(outer_aggr_keys ? outer_tuples * 4 *
+				 NS_SORT_PASS : 0)) / threads;
+
+	plan->engine = -1;
+	int engine;
+	for (engine = 0; engine != PLANS; ++engine)
+		if (plan->cost[engine] >= 0 && (plan->engine < 0 ||
+		    plan->cost[engine] < plan->cost[plan->engine]))
+			plan->engine = engine;
+	assert(plan->engine >= 0);
+
+	const char *force = getenv("Q4112_PLAN");
+	for (engine = 0; force != NULL && engine != PLANS; ++engine)
+		if (strcmp(force, plan_names[engine]) == 0)
+			break;
+	if (force != NULL && engine == PLANS) {
+		fprintf(stderr, "plan: unknown Q4112_PLAN=%s, using %s\n",
+			force, plan_names[plan->engine]);
+	} else if (force != NULL && plan->cost[engine] < 0) {
+		fprintf(stderr, "plan: Q4112_PLAN=%s cannot run %s queries, "
+			"using %s\n", force,
+			outer_aggr_keys ? "grouped" : "global",
+			plan_names[plan->engine]);
+	} else if (force != NULL) {
+		plan->engine = engine;
+		snprintf(plan->reason, sizeof(plan->reason),
+			 "forced by Q4112_PLAN");
+		return;
+	}
+
+	const char *table = plan->dense ? "direct array" : "hash table";
+	const char *where = plan->table_bytes <= l2 ? "fits the L2" :
+		plan->table_bytes <= llc ? "fits the LLC" : "exceeds the LLC";
+	switch (plan->engine) {
+	case PLAN_NLJ:
+		snprintf(plan->reason, sizeof(plan->reason),
+			 "inner table of %zu tuples is cheaper to scan than to hash",
+			 inner_tuples);
+		break;
+	case PLAN_SMJ:
+		snprintf(plan->reason, sizeof(plan->reason),
+			 "%s of %zuKB %s, sorting streams through memory",
+			 table, plan->table_bytes >> 10, where);
+		break;
+	case PLAN_RADIX:
+		snprintf(plan->reason, sizeof(plan->reason),
+			 "%s of %zuKB %s, partitioning is cheaper on %d threads",
+			 table, plan->table_bytes >> 10, where, threads);
+		break;
+	default:
+		snprintf(plan->reason, sizeof(plan->reason),
+			 "%s of %zuKB %s",
+			 table, plan->table_bytes >> 10, where);
+		break;
+	}
+}
+
+void plan_report(const q4112_plan_t *plan)
+{
+	int engine;
+	fprintf(stderr, "plan: %s (%s)\n", plan_name(plan->engine),
+		plan->reason);
+	fprintf(stderr, "plan: keys [%u, %u], %.0f groups\n",
+		plan->key_min, plan->key_max, plan->groups);
+	for (engine = 0; engine != PLANS; ++engine)
+		if (plan->cost[engine] >= 0)
+			fprintf(stderr, "plan: %-6s %14.0f ns (estimated)\n",
+				plan_name(engine), plan->cost[engine]);
+}
+
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	static uint64_t (*const engines[PLANS])(Q4112_RUN_ARGS) = {
+		q4112_run_nlj, q4112_run_hj_1, q4112_run_hj, q4112_run_radix,
+		q4112_run_smj
+	};
+	static uint64_t (*const range_engines[PLANS])(Q4112_RUN_ARGS,
+						      const dense_range_t *) = {
+		NULL, q4112_run_hj_1_range, q4112_run_hj_range, NULL, NULL
+	};
+	q4112_plan_t plan;
+	plan_query(&plan, inner_keys, inner_tuples, outer_aggr_keys,
+		   outer_tuples, threads);
+	if (getenv("Q4112_STATS") != NULL)
+		plan_report(&plan);
+	if (plan.engine == PLAN_HJ_1)
+		threads = 1;
+	/*the hash joins take the key range of the plan instead of a scan*/
+	dense_range_t range = { plan.key_min, plan.key_max };
+	if (range_engines[plan.engine] != NULL)
+		return range_engines[plan.engine](inner_keys, inner_vals,
+						  inner_tuples,
+						  outer_join_keys,
+						  outer_aggr_keys, outer_vals,
+						  outer_tuples, threads,
+						  &range);
+	return engines[plan.engine](inner_keys, inner_vals, inner_tuples,
+				    outer_join_keys, outer_aggr_keys,
+				    outer_vals, outer_tuples, threads);
+}
@@ -0,0 +1,67 @@
+#ifndef _Q4112_PLAN_
+#define _Q4112_PLAN_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "q4112_dense.h"
+
+/*
+ * engines the planner dispatches to: the q4112_run of every engine file,
+ * compiled a second time with the entry point renamed (see Makefile)
+ */
+enum {
+	PLAN_NLJ,
+	PLAN_HJ_1,
+	PLAN_HJ,
+	PLAN_RADIX,
+	PLAN_SMJ,
+	PLANS
+};
+
+#define Q4112_RUN_ARGS const uint32_t *inner_keys,			\
+	const uint32_t *inner_vals, size_t inner_tuples,		\
+	const uint32_t *outer_join_keys, const uint32_t *outer_aggr_keys, \
+	const uint32_t *outer_vals, size_t outer_tuples, int threads
+
+uint64_t q4112_run_nlj(Q4112_RUN_ARGS);
+uint64_t q4112_run_hj_1(Q4112_RUN_ARGS);
+uint64_t q4112_run_hj(Q4112_RUN_ARGS);
+uint64_t q4112_run_radix(Q4112_RUN_ARGS);
+uint64_t q4112_run_smj(Q4112_RUN_ARGS);
+
+/* q4112_run_range of the engines with a direct array */
+uint64_t q4112_run_hj_1_range(Q4112_RUN_ARGS, const dense_range_t *range);
+uint64_t q4112_run_hj_range(Q4112_RUN_ARGS, const dense_range_t *range);
+
+typedef struct {
+	int engine;
+	/* estimated nanoseconds of every engine, negative if it can not
+	 * run the query
+	 */
+	double cost[PLANS];
+	/* statistics the costs are derived from */
+	uint32_t key_min;
+	uint32_t key_max;
+	double groups;
+	/* the hash joins use a direct array of table_bytes */
+	int dense;
+	size_t table_bytes;
+	char reason[128];
+} q4112_plan_t;
+
+const char *plan_name(int engine);
+
+/*
+ * pick the cheapest engine from the inner key range, the estimated
+ * groups, the table sizes against the caches and the threads;
+ * Q4112_PLAN=<name> forces an engine
+ */
+void plan_query(q4112_plan_t *plan, const uint32_t *inner_keys,
+		size_t inner_tuples, const uint32_t *outer_aggr_keys,
+		size_t outer_tuples, int threads);
+
+/* print the chosen plan, its reason and all costs to stderr */
+void plan_report(const q4112_plan_t *plan);
+
+#endif
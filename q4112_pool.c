@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "q4112_pool.h"
+
+/* default number of tuples per morsel */
+#define MORSEL_TUPLES 16384
+
+/* bump allocator; overflow blocks are merged into one at reset */
+typedef struct {
+	char *base;
+	size_t size;
+	size_t used;
+	/* bytes handed out from overflow blocks since the last reset */
+	size_t overflow;
+	void **blocks;
+	size_t nblocks;
+} arena_t;
+
+typedef struct {
+	pthread_t id;
+	int thread;
+	q4112_pool_t *pool;
+	arena_t arena;
+	/* timing of the last task */
+	uint64_t busy_ns;
+	uint64_t idle_ns;
+	uint64_t end_ns;
+} worker_t;
+
+struct q4112_pool {
+	int threads;
+	worker_t *workers;
+	pthread_barrier_t barrier;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	/* bumped for every task; workers wait for a new generation */
+	uint64_t generation;
+	int running;
+	int shutdown;
+	/* set under default_pool_lock while this is the default pool */
+	int is_default;
+	pool_task_t task;
+	void *arg;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000 * 1000 * 1000 + t.tv_nsec;
+}
+
+static void arena_reset(arena_t *arena)
+{
+	size_t i;
+	if (arena->nblocks != 0) {
+		size_t size = arena->size + arena->overflow;
+		for (i = 0; i != arena->nblocks; ++i)
+			free(arena->blocks[i]);
+		free(arena->blocks);
+		arena->blocks = NULL;
+		arena->nblocks = 0;
+		free(arena->base);
+		arena->base = (char *) aligned_alloc(64, size);
+		assert(arena->base != NULL);
+		arena->size = size;
+	}
+	arena->used = 0;
+	arena->overflow = 0;
+}
+
+static void arena_free(arena_t *arena)
+{
+	size_t i;
+	for (i = 0; i != arena->nblocks; ++i)
+		free(arena->blocks[i]);
+	free(arena->blocks);
+	free(arena->base);
+	memset(arena, 0, sizeof(arena_t));
+}
+
+static void *arena_alloc(arena_t *arena, size_t bytes)
+{
+	bytes = (bytes + 63) & ~((size_t) 63);
+	if (arena->used + bytes <= arena->size) {
+		void *ptr = arena->base + arena->used;
+		arena->used += bytes;
+		return ptr;
+	}
+	/* keep earlier allocations valid until the next reset */
+	void *ptr = aligned_alloc(64, bytes);
+	assert(ptr != NULL);
+	arena->blocks = (void **) realloc(arena->blocks,
+					  (arena->nblocks + 1) * sizeof(void *));
+	assert(arena->blocks != NULL);
+	arena->blocks[arena->nblocks++] = ptr;
+	arena->overflow += bytes;
+	return ptr;
+}
+
+static void *pool_worker(void *arg)
+{
+	worker_t *worker = (worker_t *) arg;
+	q4112_pool_t *pool = worker->pool;
+	uint64_t generation = 0;
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->generation == generation && !pool->shutdown)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->shutdown) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		generation = pool->generation;
+		pool_task_t task = pool->task;
+		void *task_arg = pool->arg;
+		pthread_mutex_unlock(&pool->lock);
+
+		arena_reset(&worker->arena);
+		worker->idle_ns = 0;
+		uint64_t beg_ns = now_ns();
+		task(pool, worker->thread, task_arg);
+		worker->end_ns = now_ns();
+		worker->busy_ns = worker->end_ns - beg_ns - worker->idle_ns;
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return NULL;
+}
+
+/* workers of unpinned pools are placed by the scheduler */
+static q4112_pool_t *pool_start(int threads, int pinned)
+{
+	int t, c, cpus = 0;
+	int cpu[CPU_SETSIZE];
+	cpu_set_t allowed;
+	assert(threads > 0);
+	const char *pin = getenv("Q4112_PIN");
+	if (!pinned || (pin != NULL && atoi(pin) == 0))
+		CPU_ZERO(&allowed);
+	else if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		CPU_ZERO(&allowed);
+	for (c = 0; c != CPU_SETSIZE; ++c)
+		if (CPU_ISSET(c, &allowed))
+			cpu[cpus++] = c;
+	q4112_pool_t *pool = (q4112_pool_t *) calloc(1, sizeof(q4112_pool_t));
+	assert(pool != NULL);
+	pool->threads = threads;
+	pool->workers = (worker_t *) calloc(threads, sizeof(worker_t));
+	assert(pool->workers != NULL);
+	pthread_barrier_init(&pool->barrier, NULL, threads);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (t = 0; t != threads; ++t) {
+		pool->workers[t].thread = t;
+		pool->workers[t].pool = pool;
+		pthread_create(&pool->workers[t].id, NULL, pool_worker,
+			       &pool->workers[t]);
+		if (cpus != 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu[t % cpus], &set);
+			pthread_setaffinity_np(pool->workers[t].id,
+					       sizeof(set), &set);
+		}
+	}
+	return pool;
+}
+
+q4112_pool_t *pool_create(int threads)
+{
+	return pool_start(threads, 1);
+}
+
+void pool_destroy(q4112_pool_t *pool)
+{
+	int t;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (t = 0; t != pool->threads; ++t) {
+		pthread_join(pool->workers[t].id, NULL);
+		arena_free(&pool->workers[t].arena);
+	}
+	pthread_barrier_destroy(&pool->barrier);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->workers);
+	free(pool);
+}
+
+static q4112_pool_t *default_pool = NULL;
+static pthread_mutex_t default_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+q4112_pool_t *pool_acquire(int threads)
+{
+	/*
+	 * the busy default pool is pinned to the first cpus of the mask, a
+	 * concurrent query leaves its workers to the scheduler rather than
+	 * stacking them on the same cpus
+	 */
+	if (pthread_mutex_trylock(&default_pool_lock) != 0)
+		return pool_start(threads, 0);
+	if (default_pool != NULL && default_pool->threads != threads) {
+		pool_destroy(default_pool);
+		default_pool = NULL;
+	}
+	if (default_pool == NULL) {
+		default_pool = pool_create(threads);
+		default_pool->is_default = 1;
+	}
+	return default_pool;
+}
+
+void pool_release(q4112_pool_t *pool)
+{
+	/*
+	 * only the holder of default_pool_lock sees the default pool, so
+	 * its flag is stable here while default_pool itself may be swapped
+	 */
+	if (pool->is_default)
+		pthread_mutex_unlock(&default_pool_lock);
+	else
+		pool_destroy(pool);
+}
+
+int pool_threads(const q4112_pool_t *pool)
+{
+	return pool->threads;
+}
+
+void pool_run(q4112_pool_t *pool, pool_task_t task, void *arg)
+{
+	pthread_mutex_lock(&pool->lock);
+	assert(pool->running == 0);
+	pool->task = task;
+	pool->arg = arg;
+	pool->running = pool->threads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	while (pool->running != 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	/*waiting for the last worker to finish is idle time as well*/
+	int t;
+	uint64_t end_ns = 0;
+	for (t = 0; t != pool->threads; ++t)
+		if (pool->workers[t].end_ns > end_ns)
+			end_ns = pool->workers[t].end_ns;
+	for (t = 0; t != pool->threads; ++t)
+		pool->workers[t].idle_ns += end_ns - pool->workers[t].end_ns;
+}
+
+void pool_barrier(q4112_pool_t *pool, int thread)
+{
+	uint64_t beg_ns = now_ns();
+	pthread_barrier_wait(&pool->barrier);
+	pool->workers[thread].idle_ns += now_ns() - beg_ns;
+}
+
+void pool_times(const q4112_pool_t *pool, int thread,
+		uint64_t *busy_ns, uint64_t *idle_ns)
+{
+	*busy_ns = pool->workers[thread].busy_ns;
+	*idle_ns = pool->workers[thread].idle_ns;
+}
+
+void pool_report(const q4112_pool_t *pool, const char *name)
+{
+	int t;
+	for (t = 0; t != pool->threads; ++t)
+		fprintf(stderr, "%s thread %2d: busy %12llu ns idle %12llu ns\n",
+			name, t,
+			(unsigned long long) pool->workers[t].busy_ns,
+			(unsigned long long) pool->workers[t].idle_ns);
+}
+
+void morsel_init(morsel_cursor_t *cursor, size_t beg, size_t end)
+{
+	const char *morsel = getenv("Q4112_MORSEL");
+	cursor->next = beg;
+	cursor->end = end;
+	cursor->morsel = MORSEL_TUPLES;
+	if (morsel != NULL && atoll(morsel) > 0)
+		cursor->morsel = atoll(morsel);
+}
+
+int morsel_next(morsel_cursor_t *cursor, size_t *beg, size_t *end)
+{
+	if (cursor->next >= cursor->end)
+		return 0;
+	*beg = __sync_fetch_and_add(&cursor->next, cursor->morsel);
+	if (*beg >= cursor->end)
+		return 0;
+	*end = cursor->end - *beg < cursor->morsel ?
+		cursor->end : *beg + cursor->morsel;
+	return 1;
+}
+
+void *pool_alloc(q4112_pool_t *pool, int thread, size_t bytes)
+{
+	return arena_alloc(&pool->workers[thread].arena, bytes);
+}
+
+void *pool_calloc(q4112_pool_t *pool, int thread, size_t bytes)
+{
+	void *ptr = pool_alloc(pool, thread, bytes);
+	memset(ptr, 0, bytes);
+	return ptr;
+}
+
+/* min and max of the keys, per thread of the range task */
+typedef struct {
+	const uint32_t *keys;
+	uint32_t *mins;
+	uint32_t *maxs;
+	morsel_cursor_t cursor;
+} key_range_t;
+
+static void key_range_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	key_range_t *range = (key_range_t *) arg;
+	uint32_t min = UINT32_MAX, max = 0;
+	size_t beg, end, i;
+	while (morsel_next(&range->cursor, &beg, &end)) {
+		for (i = beg; i != end; ++i) {
+			uint32_t key = range->keys[i];
+			min = key < min ? key : min;
+			max = key > max ? key : max;
+		}
+	}
+	range->mins[thread] = min;
+	range->maxs[thread] = max;
+}
+
+void pool_key_range(q4112_pool_t *pool, const uint32_t *keys, size_t n,
+		    uint32_t *min, uint32_t *max)
+{
+	int t, threads = pool_threads(pool);
+	key_range_t range;
+	range.keys = keys;
+	range.mins = (uint32_t *) malloc(threads * sizeof(uint32_t));
+	range.maxs = (uint32_t *) malloc(threads * sizeof(uint32_t));
+	assert(range.mins != NULL && range.maxs != NULL);
+	morsel_init(&range.cursor, 0, n);
+	pool_run(pool, key_range_thread, &range);
+	*min = UINT32_MAX;
+	*max = 0;
+	for (t = 0; t != threads; ++t) {
+		*min = range.mins[t] < *min ? range.mins[t] : *min;
+		*max = range.maxs[t] > *max ? range.maxs[t] : *max;
+	}
+	free(range.mins);
+	free(range.maxs);
+}
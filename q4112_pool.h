@@ -0,0 +1,93 @@
+#ifndef _Q4112_POOL_
+#define _Q4112_POOL_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * persistent pool of worker threads that runs one parallel task at a
+ * time; the workers, their scratch arenas and the phase barrier are
+ * reused by every query executed on the pool
+ */
+typedef struct q4112_pool q4112_pool_t;
+
+typedef void (*pool_task_t)(q4112_pool_t *pool, int thread, void *arg);
+
+/*
+ * start workers pinned round robin to the cpus in the affinity mask of
+ * the caller (Q4112_PIN=0 disables)
+ */
+q4112_pool_t *pool_create(int threads);
+
+void pool_destroy(q4112_pool_t *pool);
+
+/*
+ * process wide pool reused by back to back calls of all engines; a call
+ * that finds it busy (concurrent callers) gets an unpinned pool of its
+ * own, which pool_release destroys
+ */
+q4112_pool_t *pool_acquire(int threads);
+
+void pool_release(q4112_pool_t *pool);
+
+int pool_threads(const q4112_pool_t *pool);
+
+/* run task(pool, thread, arg) on all workers and wait for all of them */
+void pool_run(q4112_pool_t *pool, pool_task_t task, void *arg);
+
+/*
+ * wait until all workers of the running task reach the barrier; the
+ * wait is accounted as idle time of the thread
+ */
+void pool_barrier(q4112_pool_t *pool, int thread);
+
+/*
+ * busy and idle (barrier and end of task wait) nanoseconds of a worker
+ * during the last task
+ */
+void pool_times(const q4112_pool_t *pool, int thread,
+		uint64_t *busy_ns, uint64_t *idle_ns);
+
+/* print pool_times of all workers to stderr */
+void pool_report(const q4112_pool_t *pool, const char *name);
+
+/*
+ * shared cursor that hands out morsels of [beg, end) to whichever
+ * worker asks next, so fast workers take over the work of slow ones
+ */
+typedef struct {
+	size_t next;
+	size_t end;
+	size_t morsel;
+} morsel_cursor_t;
+
+/* morsel tuples default to 16K, Q4112_MORSEL overrides */
+void morsel_init(morsel_cursor_t *cursor, size_t beg, size_t end);
+
+/* claim the next morsel [*beg, *end); returns 0 when none is left */
+int morsel_next(morsel_cursor_t *cursor, size_t *beg, size_t *end);
+
+/*
+ * allocate 64 byte aligned scratch memory of a worker; it is valid until
+ * the task returns and is recycled by the next pool_run
+ */
+void *pool_alloc(q4112_pool_t *pool, int thread, size_t bytes);
+
+/* zeroed pool_alloc */
+void *pool_calloc(q4112_pool_t *pool, int thread, size_t bytes);
+
+/* min and max of n keys on the workers; min > max if n is 0 */
+void pool_key_range(q4112_pool_t *pool, const uint32_t *keys, size_t n,
+		    uint32_t *min, uint32_t *max);
+
+/* engines built on the pool run queries on a caller owned pool */
+uint64_t q4112_run_pool(q4112_pool_t *pool,
+			const uint32_t *inner_keys,
+			const uint32_t *inner_vals,
+			size_t inner_tuples,
+			const uint32_t *outer_join_keys,
+			const uint32_t *outer_aggr_keys,
+			const uint32_t *outer_vals,
+			size_t outer_tuples);
+
+#endif
@@ -0,0 +1,452 @@
+#include <assert.h>
+#include <immintrin.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q4112_probe.h"
+
+/*
+ * the gathers address the table as 32-bit words (key at 2h, value at
+ * 2h + 1) with signed 32-bit indexes; bigger tables use the scalar kernel
+ */
+#define SIMD_MAX_LOG_BUCKETS 29
+/* upper bound of Q4112_PROBE_BATCH */
+#define MAX_PROBE_BATCH 64
+
+static size_t probe_block_scalar(const bucket_t *table, int8_t log_buckets,
+				 const uint32_t *keys, size_t n,
+				 uint32_t *sel, uint32_t *vals)
+{
+	size_t buckets = ((size_t) 1) << log_buckets;
+	size_t i, h, m = 0;
+	for (i = 0; i != n; ++i) {
+		uint32_t key = keys[i];
+		h = (uint32_t) (key * BIG_NUMBER);
+		h >>= 32 - log_buckets;
+		uint32_t tab = table[h].key;
+		while (tab != 0) {
+			if (tab == key) {
+				sel[m] = i;
+				vals[m++] = table[h].val;
+				break;
+			}
+			h = (h + 1) & (buckets - 1);
+			tab = table[h].key;
+		}
+	}
+	return m;
+}
+
+static void probe_sum_scalar(const bucket_t *table, int8_t log_buckets,
+			     const uint32_t *keys, const uint32_t *outer_vals,
+			     size_t n, aggr_sum_t *sum, uint64_t *count)
+{
+	size_t buckets = ((size_t) 1) << log_buckets;
+	size_t i, h;
+	aggr_sum_t s = 0;
+	uint64_t c = 0;
+	for (i = 0; i != n; ++i) {
+		uint32_t key = keys[i];
+		h = (uint32_t) (key * BIG_NUMBER);
+		h >>= 32 - log_buckets;
+		uint32_t tab = table[h].key;
+		while (tab != 0) {
+			if (tab == key) {
+				s += table[h].val * (uint64_t) outer_vals[i];
+				c += 1;
+				break;
+			}
+			h = (h + 1) & (buckets - 1);
+			tab = table[h].key;
+		}
+	}
+	*sum += s;
+	*count += c;
+}
+
+/*
+ * probe 8 keys at once: every lane walks its own probe chain and the
+ * loop runs until all lanes either matched or hit an empty bucket;
+ * returns the mask of matched lanes and their inner values in *vals
+ */
+__attribute__((target("avx2")))
+static inline __m256i probe_8_avx2(const int *base, __m256i key,
+				   __m128i shift, __m256i mask,
+				   __m256i *vals)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	__m256i h = _mm256_srl_epi32(
+		_mm256_mullo_epi32(key, _mm256_set1_epi32(BIG_NUMBER)), shift);
+	__m256i active = _mm256_cmpeq_epi32(zero, zero);
+	__m256i hit = zero;
+	__m256i val = zero;
+	do {
+		__m256i idx = _mm256_add_epi32(h, h);
+		__m256i tab = _mm256_mask_i32gather_epi32(zero, base, idx,
+							  active, 4);
+		__m256i match = _mm256_and_si256(active,
+						 _mm256_cmpeq_epi32(tab, key));
+		__m256i empty = _mm256_and_si256(active,
+						 _mm256_cmpeq_epi32(tab, zero));
+		if (!_mm256_testz_si256(match, match)) {
+			/* masked re-gather of the values of matched lanes */
+			val = _mm256_mask_i32gather_epi32(
+				val, base, _mm256_add_epi32(idx, one),
+				match, 4);
+			hit = _mm256_or_si256(hit, match);
+		}
+		active = _mm256_andnot_si256(_mm256_or_si256(match, empty),
+					     active);
+		h = _mm256_and_si256(_mm256_add_epi32(h, one), mask);
+	} while (!_mm256_testz_si256(active, active));
+	*vals = val;
+	return hit;
+}
+
+__attribute__((target("avx2")))
+static size_t probe_block_avx2(const bucket_t *table, int8_t log_buckets,
+			       const uint32_t *keys, size_t n,
+			       uint32_t *sel, uint32_t *vals)
+{
+	if (log_buckets > SIMD_MAX_LOG_BUCKETS)
+		return probe_block_scalar(table, log_buckets, keys, n,
+					  sel, vals);
+	const int *base = (const int *) table;
+	const __m128i shift = _mm_cvtsi32_si128(32 - log_buckets);
+	const __m256i mask = _mm256_set1_epi32((1u << log_buckets) - 1);
+	uint32_t lane_vals[8] __attribute__((aligned(32)));
+	size_t i, m = 0;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i key = _mm256_loadu_si256((const __m256i *) &keys[i]);
+		__m256i val;
+		__m256i hit = probe_8_avx2(base, key, shift, mask, &val);
+		unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+		if (bits == 0)
+			continue;
+		_mm256_store_si256((__m256i *) lane_vals, val);
+		while (bits) {
+			unsigned lane = __builtin_ctz(bits);
+			sel[m] = i + lane;
+			vals[m++] = lane_vals[lane];
+			bits &= bits - 1;
+		}
+	}
+	size_t tail = probe_block_scalar(table, log_buckets, &keys[i], n - i,
+					 &sel[m], &vals[m]);
+	for (n = m + tail; m != n; ++m)
+		sel[m] += i;
+	return m;
+}
+
+__attribute__((target("avx2")))
+static void probe_sum_avx2(const bucket_t *table, int8_t log_buckets,
+			   const uint32_t *keys, const uint32_t *outer_vals,
+			   size_t n, aggr_sum_t *sum, uint64_t *count)
+{
+	if (log_buckets > SIMD_MAX_LOG_BUCKETS) {
+		probe_sum_scalar(table, log_buckets, keys, outer_vals, n,
+				 sum, count);
+		return;
+	}
+	const int *base = (const int *) table;
+	const __m128i shift = _mm_cvtsi32_si128(32 - log_buckets);
+	const __m256i mask = _mm256_set1_epi32((1u << log_buckets) - 1);
+	__m256i acc = _mm256_setzero_si256();
+	__m256i carry = _mm256_setzero_si256();
+	uint64_t c = 0;
+	size_t i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i key = _mm256_loadu_si256((const __m256i *) &keys[i]);
+		__m256i val;
+		__m256i hit = probe_8_avx2(base, key, shift, mask, &val);
+		/* unmatched lanes have value 0 and add nothing */
+		__m256i ov = _mm256_loadu_si256(
+			(const __m256i *) &outer_vals[i]);
+		acc = aggr_lanes_add_avx2(acc, _mm256_mul_epu32(val, ov),
+					  &carry);
+		acc = aggr_lanes_add_avx2(acc, _mm256_mul_epu32(
+						  _mm256_srli_epi64(val, 32),
+						  _mm256_srli_epi64(ov, 32)),
+					  &carry);
+		c += __builtin_popcount(
+			_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+	}
+	*sum += aggr_lanes_sum_avx2(acc, carry);
+	*count += c;
+	probe_sum_scalar(table, log_buckets, &keys[i], &outer_vals[i], n - i,
+			 sum, count);
+}
+
+/* 16 lane version of probe_8_avx2 using mask registers */
+__attribute__((target("avx512f")))
+static inline __mmask16 probe_16_avx512(const int *base, __m512i key,
+					__m128i shift, __m512i mask,
+					__m512i *vals)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i one = _mm512_set1_epi32(1);
+	__m512i h = _mm512_srl_epi32(
+		_mm512_mullo_epi32(key, _mm512_set1_epi32(BIG_NUMBER)), shift);
+	__mmask16 active = 0xffff;
+	__mmask16 hit = 0;
+	__m512i val = zero;
+	do {
+		__m512i idx = _mm512_add_epi32(h, h);
+		__m512i tab = _mm512_mask_i32gather_epi32(zero, active, idx,
+							  base, 4);
+		__mmask16 match = _mm512_mask_cmpeq_epi32_mask(active,
+							       tab, key);
+		__mmask16 empty = _mm512_mask_cmpeq_epi32_mask(active,
+							       tab, zero);
+		if (match) {
+			val = _mm512_mask_i32gather_epi32(
+				val, match, _mm512_add_epi32(idx, one),
+				base, 4);
+			hit |= match;
+		}
+		active &= ~(match | empty);
+		h = _mm512_and_si512(_mm512_add_epi32(h, one), mask);
+	} while (active);
+	*vals = val;
+	return hit;
+}
+
+__attribute__((target("avx512f")))
+static size_t probe_block_avx512(const bucket_t *table, int8_t log_buckets,
+				 const uint32_t *keys, size_t n,
+				 uint32_t *sel, uint32_t *vals)
+{
+	if (log_buckets > SIMD_MAX_LOG_BUCKETS)
+		return probe_block_scalar(table, log_buckets, keys, n,
+					  sel, vals);
+	const int *base = (const int *) table;
+	const __m128i shift = _mm_cvtsi32_si128(32 - log_buckets);
+	const __m512i mask = _mm512_set1_epi32((1u << log_buckets) - 1);
+	const __m512i iota = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+					      7, 6, 5, 4, 3, 2, 1, 0);
+	size_t i, m = 0;
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512i key = _mm512_loadu_si512(&keys[i]);
+		__m512i val;
+		__mmask16 hit = probe_16_avx512(base, key, shift, mask, &val);
+		if (hit == 0)
+			continue;
+		_mm512_mask_compressstoreu_epi32(
+			&sel[m], hit,
+			_mm512_add_epi32(iota, _mm512_set1_epi32(i)));
+		_mm512_mask_compressstoreu_epi32(&vals[m], hit, val);
+		m += __builtin_popcount(hit);
+	}
+	size_t tail = probe_block_scalar(table, log_buckets, &keys[i], n - i,
+					 &sel[m], &vals[m]);
+	for (n = m + tail; m != n; ++m)
+		sel[m] += i;
+	return m;
+}
+
+__attribute__((target("avx512f")))
+static void probe_sum_avx512(const bucket_t *table, int8_t log_buckets,
+			     const uint32_t *keys, const uint32_t *outer_vals,
+			     size_t n, aggr_sum_t *sum, uint64_t *count)
+{
+	if (log_buckets > SIMD_MAX_LOG_BUCKETS) {
+		probe_sum_scalar(table, log_buckets, keys, outer_vals, n,
+				 sum, count);
+		return;
+	}
+	const int *base = (const int *) table;
+	const __m128i shift = _mm_cvtsi32_si128(32 - log_buckets);
+	const __m512i mask = _mm512_set1_epi32((1u << log_buckets) - 1);
+	__m512i acc = _mm512_setzero_si512();
+	__m512i carry = _mm512_setzero_si512();
+	uint64_t c = 0;
+	size_t i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512i key = _mm512_loadu_si512(&keys[i]);
+		__m512i val;
+		__mmask16 hit = probe_16_avx512(base, key, shift, mask, &val);
+		__m512i ov = _mm512_loadu_si512(&outer_vals[i]);
+		acc = aggr_lanes_add_avx512(acc, _mm512_mul_epu32(val, ov),
+					    &carry);
+		acc = aggr_lanes_add_avx512(acc, _mm512_mul_epu32(
+						    _mm512_srli_epi64(val, 32),
+						    _mm512_srli_epi64(ov, 32)),
+					    &carry);
+		c += __builtin_popcount(hit);
+	}
+	*sum += aggr_lanes_sum_avx512(acc, carry);
+	*count += c;
+	probe_sum_scalar(table, log_buckets, &keys[i], &outer_vals[i], n - i,
+			 sum, count);
+}
+
+/*
+ * group prefetching: hash a group of keys and prefetch their buckets,
+ * then walk the probe chains of the group while the misses overlap
+ */
+static size_t probe_block_group(const bucket_t *table, int8_t log_buckets,
+				const uint32_t *keys, size_t n,
+				uint32_t *sel, uint32_t *vals)
+{
+	size_t buckets = ((size_t) 1) << log_buckets;
+	size_t batch = probe_kernel()->batch;
+	size_t hs[MAX_PROBE_BATCH];
+	size_t i, j, h, m = 0;
+	for (i = 0; i < n; i += batch) {
+		size_t g = n - i < batch ? n - i : batch;
+		for (j = 0; j != g; ++j) {
+			h = (uint32_t) (keys[i + j] * BIG_NUMBER);
+			hs[j] = h >> (32 - log_buckets);
+			__builtin_prefetch(&table[hs[j]]);
+		}
+		for (j = 0; j != g; ++j) {
+			uint32_t key = keys[i + j];
+			h = hs[j];
+			uint32_t tab = table[h].key;
+			while (tab != 0) {
+				if (tab == key) {
+					sel[m] = i + j;
+					vals[m++] = table[h].val;
+					break;
+				}
+				h = (h + 1) & (buckets - 1);
+				tab = table[h].key;
+			}
+		}
+	}
+	return m;
+}
+
+/*
+ * asynchronous memory access chaining: a ring of independent lookups,
+ * each prefetches its next bucket and yields to the others before
+ * touching it; finished lookups are refilled with the next key
+ */
+static size_t probe_block_amac(const bucket_t *table, int8_t log_buckets,
+			       const uint32_t *keys, size_t n,
+			       uint32_t *sel, uint32_t *vals)
+{
+	size_t buckets = ((size_t) 1) << log_buckets;
+	size_t batch = probe_kernel()->batch;
+	struct {
+		size_t pos;
+		size_t h;
+		int busy;
+	} slot[MAX_PROBE_BATCH];
+	size_t i = 0, j, busy = 0, m = 0;
+	for (j = 0; j != batch; ++j)
+		slot[j].busy = 0;
+	j = 0;
+	while (i != n || busy != 0) {
+		if (!slot[j].busy) {
+			if (i != n) {
+				size_t h = (uint32_t) (keys[i] * BIG_NUMBER);
+				slot[j].h = h >> (32 - log_buckets);
+				slot[j].pos = i++;
+				slot[j].busy = 1;
+				busy++;
+				__builtin_prefetch(&table[slot[j].h]);
+			}
+		} else {
+			uint32_t tab = table[slot[j].h].key;
+			if (tab == keys[slot[j].pos]) {
+				sel[m] = slot[j].pos;
+				vals[m++] = table[slot[j].h].val;
+				slot[j].busy = 0;
+				busy--;
+			} else if (tab == 0) {
+				slot[j].busy = 0;
+				busy--;
+			} else {
+				slot[j].h = (slot[j].h + 1) & (buckets - 1);
+				__builtin_prefetch(&table[slot[j].h]);
+			}
+		}
+		j = j + 1 == batch ? 0 : j + 1;
+	}
+	return m;
+}
+
+/* sum on top of a block kernel for kernels without a fused version */
+#define PROBE_SUM_BLOCKED(kernel)					\
+static void probe_sum_##kernel(const bucket_t *table, int8_t log_buckets, \
+			       const uint32_t *keys,			\
+			       const uint32_t *outer_vals,		\
+			       size_t n, aggr_sum_t *sum, uint64_t *count) \
+{									\
+	uint32_t sel[1024];						\
+	uint32_t vals[1024];						\
+	size_t i, j, m;							\
+	aggr_sum_t s = 0;						\
+	for (i = 0; i < n; i += 1024) {					\
+		m = probe_block_##kernel(table, log_buckets, &keys[i],	\
+					 n - i < 1024 ? n - i : 1024,	\
+					 sel, vals);			\
+		for (j = 0; j != m; ++j)				\
+			s += vals[j] *					\
+				(uint64_t) outer_vals[i + sel[j]];	\
+		*count += m;						\
+	}								\
+	*sum += s;							\
+}
+
+PROBE_SUM_BLOCKED(group)
+PROBE_SUM_BLOCKED(amac)
+
+static const probe_kernel_t kernels[] = {
+	{ "scalar", 0, 0, probe_block_scalar, probe_sum_scalar },
+	{ "avx2", 0, 0, probe_block_avx2, probe_sum_avx2 },
+	{ "avx512", 0, 0, probe_block_avx512, probe_sum_avx512 },
+	{ "group", 1, 0, probe_block_group, probe_sum_group },
+	{ "amac", 1, 0, probe_block_amac, probe_sum_amac },
+};
+
+static probe_kernel_t selected;
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+static int selected_simd;
+
+static void probe_kernel_select(void)
+{
+	int best = 0;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		best = 1;
+	if (__builtin_cpu_supports("avx512f"))
+		best = 2;
+	/* a forced kernel is only used if the CPU supports it */
+	const char *force = getenv("Q4112_SIMD");
+	int k;
+	for (k = 0; force != NULL && k <= best; ++k)
+		if (strcmp(force, kernels[k].name) == 0)
+			best = k;
+	selected_simd = best;
+	/* prefetching kernels replace the vectorized ones when asked for */
+	const char *mode = getenv("Q4112_PROBE");
+	for (k = 0; mode != NULL && k != sizeof(kernels) / sizeof(*kernels); ++k)
+		if (kernels[k].prefetch && strcmp(mode, kernels[k].name) == 0)
+			best = k;
+	selected = kernels[best];
+	/*clamp before storing, a negative batch must not wrap the size_t*/
+	const char *env = getenv("Q4112_PROBE_BATCH");
+	long batch = env != NULL ? strtol(env, NULL, 10) : 16;
+	if (batch < 1)
+		batch = 1;
+	if (batch > MAX_PROBE_BATCH)
+		batch = MAX_PROBE_BATCH;
+	selected.batch = batch;
+}
+
+const probe_kernel_t *probe_kernel(void)
+{
+	pthread_once(&selected_once, probe_kernel_select);
+	return &selected;
+}
+
+int simd_level(void)
+{
+	pthread_once(&selected_once, probe_kernel_select);
+	return selected_simd;
+}
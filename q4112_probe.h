@@ -0,0 +1,57 @@
+#ifndef _Q4112_PROBE_
+#define _Q4112_PROBE_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "q4112_aggr.h"
+
+#define BIG_NUMBER 0x9e3779b1
+
+/* linear probing hash table bucket; key 0 marks an empty bucket */
+typedef struct {
+	uint32_t key;
+	uint32_t val;
+} bucket_t;
+
+/*
+ * probe kernels for a table of 2^log_buckets buckets built with
+ * multiplicative hashing and linear probing (join on primary key)
+ */
+typedef struct {
+	const char *name;
+	/* non-zero if the kernel prefetches buckets in batches */
+	int prefetch;
+	/* lookups in flight for the prefetching kernels */
+	size_t batch;
+	/* probe keys[0..n); for every match write the position in keys to
+	 * sel and the inner value to vals; returns the number of matches
+	 * (the prefetching kernels do not keep sel in ascending order)
+	 */
+	size_t (*block)(const bucket_t *table, int8_t log_buckets,
+			const uint32_t *keys, size_t n,
+			uint32_t *sel, uint32_t *vals);
+	/* probe keys[0..n) and add val * outer_vals[i] of every match to
+	 * sum and the number of matches to count; every product can be
+	 * close to 2^64, so the sum is 128-bit
+	 */
+	void (*sum)(const bucket_t *table, int8_t log_buckets,
+		    const uint32_t *keys, const uint32_t *outer_vals,
+		    size_t n, aggr_sum_t *sum, uint64_t *count);
+} probe_kernel_t;
+
+/*
+ * best kernel for the running CPU (AVX-512, AVX2 or scalar); can be
+ * forced with Q4112_SIMD=scalar|avx2|avx512 to compare kernels;
+ * Q4112_PROBE=group|amac selects a software pipelined kernel instead,
+ * with Q4112_PROBE_BATCH lookups in flight (default 16, at most 64)
+ */
+const probe_kernel_t *probe_kernel(void);
+
+/* SIMD_SCALAR, SIMD_AVX2 or SIMD_AVX512 as selected for probe_kernel */
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+int simd_level(void);
+
+#endif
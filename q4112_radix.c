@@ -0,0 +1,459 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112_aggr.h"
+
+#define BIG_NUMBER 0x9e3779b1
+
+/* radix bits per partitioning pass; 2^6 output streams per thread stay
+ * within the L1 TLB reach during the scatter
+ */
+#define PASS_BITS 6
+/* inner tuples per final partition; with a 2/3 fill rate the partition
+ * hash table is 64KB and stays in L2 while the outer partition streams
+ */
+#define PARTITION_TUPLES 4096
+/* at most two passes of at most PASS_BITS each; past 2^24 inner tuples
+ * the final partitions grow beyond PARTITION_TUPLES instead
+ */
+#define MAX_RADIX_BITS (2 * PASS_BITS)
+
+typedef struct {
+	uint32_t key;
+	uint32_t val;
+} bucket_t;
+
+typedef struct {
+	uint32_t key;
+	uint32_t val;
+	uint32_t aggr_key;
+} outer_tuple_t;
+
+typedef struct {
+	int threads;
+	size_t inner_tuples;
+	size_t outer_tuples;
+	const uint32_t *inner_keys;
+	const uint32_t *inner_vals;
+	const uint32_t *outer_keys;
+	const uint32_t *outer_vals;
+	const uint32_t *outer_aggr_keys;
+	/* bits of the first and second pass */
+	int8_t bits_1;
+	int8_t bits_2;
+	size_t partitions;
+	/* per thread histograms of the first pass (threads x partitions) */
+	size_t *inner_hist;
+	size_t *outer_hist;
+	/* partition boundaries after the first pass (partitions + 1) */
+	size_t *inner_offs;
+	size_t *outer_offs;
+	bucket_t *inner_part;
+	outer_tuple_t *outer_part;
+	/* next first pass partition to be joined */
+	size_t next_partition;
+	/* groups exchanged between threads for the final aggregation */
+	aggr_exchange_t exchange;
+	pthread_barrier_t barrier;
+} radix_query_t;
+
+typedef struct {
+	pthread_t id;
+	int thread;
+	radix_query_t *query;
+	aggr_sum_t sum;
+	uint64_t count;
+} thread_info_t;
+
+/*
+ * extract bits [skip, skip + bits) counting from the most significant
+ * bit of the hash; the partition passes consume the high bits first and
+ * the partition hash table uses the bits right below them
+ */
+static inline uint32_t hash_bits(uint32_t h, int8_t skip, int8_t bits)
+{
+	if (bits == 0)
+		return 0;
+	return (uint32_t) (h << skip) >> (32 - bits);
+}
+
+static int8_t log_buckets_for(size_t tuples)
+{
+	int8_t log_buckets = 1;
+	size_t buckets = 2;
+	while (buckets * 0.67 < tuples) {
+		log_buckets += 1;
+		buckets += buckets;
+	}
+	return log_buckets;
+}
+
+/*
+ * build a private hash table on an inner partition and probe it with
+ * the matching outer partition; the table is scratch memory of the
+ * thread and is reused across partitions
+ */
+static void join_partition(const radix_query_t *query,
+			   const bucket_t *inner, size_t inner_tuples,
+			   const outer_tuple_t *outer, size_t outer_tuples,
+			   bucket_t **table, size_t *table_buckets,
+			   aggr_table_t *aggr, aggr_sum_t *sum, uint64_t *count)
+{
+	int8_t skip = query->bits_1 + query->bits_2;
+	int8_t log_buckets = log_buckets_for(inner_tuples);
+	size_t buckets = ((size_t) 1) << log_buckets;
+	size_t i, o, h;
+
+	if (inner_tuples == 0 || outer_tuples == 0)
+		return;
+	if (buckets > *table_buckets) {
+		free(*table);
+		*table = (bucket_t *) malloc(buckets * sizeof(bucket_t));
+		assert(*table != NULL);
+		*table_buckets = buckets;
+	}
+	bucket_t *tab = *table;
+	memset(tab, 0, buckets * sizeof(bucket_t));
+
+	/*build*/
+	for (i = 0; i != inner_tuples; ++i) {
+		uint32_t key = inner[i].key;
+		h = hash_bits((uint32_t) (key * BIG_NUMBER), skip, log_buckets);
+		while (tab[h].key != 0)
+			h = (h + 1) & (buckets - 1);
+		tab[h].key = key;
+		tab[h].val = inner[i].val;
+	}
+
+	/*probe; join on primary key so stop at the first match*/
+	for (o = 0; o != outer_tuples; ++o) {
+		uint32_t key = outer[o].key;
+		h = hash_bits((uint32_t) (key * BIG_NUMBER), skip, log_buckets);
+		uint32_t k = tab[h].key;
+		while (k != 0) {
+			if (k == key) {
+				uint64_t extra =
+					tab[h].val * (uint64_t) outer[o].val;
+				if (query->outer_aggr_keys != NULL) {
+					aggr_table_update(aggr,
+							  outer[o].aggr_key,
+							  1, extra);
+				} else {
+					*sum += extra;
+					*count += 1;
+				}
+				break;
+			}
+			h = (h + 1) & (buckets - 1);
+			k = tab[h].key;
+		}
+	}
+}
+
+/*
+ * partition a first pass partition once more into 2^bits_2 partitions
+ * using thread private buffers, then join the partitions pairwise while
+ * they are still cache resident
+ */
+static void partition_and_join(const radix_query_t *query,
+			       const bucket_t *inner, size_t inner_tuples,
+			       const outer_tuple_t *outer, size_t outer_tuples,
+			       bucket_t **inner_buf, size_t *inner_cap,
+			       outer_tuple_t **outer_buf, size_t *outer_cap,
+			       size_t *inner_offs, size_t *outer_offs,
+			       bucket_t **table, size_t *table_buckets,
+			       aggr_table_t *aggr, aggr_sum_t *sum,
+			       uint64_t *count)
+{
+	int8_t skip = query->bits_1;
+	int8_t bits = query->bits_2;
+	size_t partitions = ((size_t) 1) << bits;
+	size_t i, p;
+
+	if (inner_tuples == 0 || outer_tuples == 0)
+		return;
+	if (inner_tuples > *inner_cap) {
+		free(*inner_buf);
+		*inner_buf = (bucket_t *)
+			malloc(inner_tuples * sizeof(bucket_t));
+		assert(*inner_buf != NULL);
+		*inner_cap = inner_tuples;
+	}
+	if (outer_tuples > *outer_cap) {
+		free(*outer_buf);
+		*outer_buf = (outer_tuple_t *)
+			malloc(outer_tuples * sizeof(outer_tuple_t));
+		assert(*outer_buf != NULL);
+		*outer_cap = outer_tuples;
+	}
+
+	/*histograms; offsets are kept one slot ahead for the scatter*/
+	memset(inner_offs, 0, (partitions + 1) * sizeof(size_t));
+	memset(outer_offs, 0, (partitions + 1) * sizeof(size_t));
+	for (i = 0; i != inner_tuples; ++i)
+		inner_offs[hash_bits((uint32_t) (inner[i].key * BIG_NUMBER),
+				     skip, bits) + 1]++;
+	for (i = 0; i != outer_tuples; ++i)
+		outer_offs[hash_bits((uint32_t) (outer[i].key * BIG_NUMBER),
+				     skip, bits) + 1]++;
+	for (p = 1; p != partitions; ++p) {
+		inner_offs[p] += inner_offs[p - 1];
+		outer_offs[p] += outer_offs[p - 1];
+	}
+
+	/*scatter*/
+	for (i = 0; i != inner_tuples; ++i) {
+		p = hash_bits((uint32_t) (inner[i].key * BIG_NUMBER),
+			      skip, bits);
+		(*inner_buf)[inner_offs[p]++] = inner[i];
+	}
+	for (i = 0; i != outer_tuples; ++i) {
+		p = hash_bits((uint32_t) (outer[i].key * BIG_NUMBER),
+			      skip, bits);
+		(*outer_buf)[outer_offs[p]++] = outer[i];
+	}
+
+	/*after the scatter offs[p] is the end of partition p*/
+	size_t inner_beg = 0, outer_beg = 0;
+	for (p = 0; p != partitions; ++p) {
+		join_partition(query, &(*inner_buf)[inner_beg],
+			       inner_offs[p] - inner_beg,
+			       &(*outer_buf)[outer_beg],
+			       outer_offs[p] - outer_beg,
+			       table, table_buckets, aggr, sum, count);
+		inner_beg = inner_offs[p];
+		outer_beg = outer_offs[p];
+	}
+}
+
+static void *radix_thread(void *arg)
+{
+	thread_info_t *info = (thread_info_t *)arg;
+	assert(pthread_equal(pthread_self(), info->id));
+
+	/*copy info*/
+	radix_query_t *query = info->query;
+	size_t thread = info->thread;
+	size_t threads = query->threads;
+	size_t partitions = query->partitions;
+	int8_t bits_1 = query->bits_1;
+	const uint32_t *outer_aggr_keys = query->outer_aggr_keys;
+	size_t *inner_hist = &query->inner_hist[thread * partitions];
+	size_t *outer_hist = &query->outer_hist[thread * partitions];
+	size_t i, p, t;
+
+	/*thread boundaries for inner and outer table*/
+	size_t inner_beg = (query->inner_tuples / threads) * (thread + 0);
+	size_t inner_end = (query->inner_tuples / threads) * (thread + 1);
+	if (thread + 1 == threads)
+		inner_end = query->inner_tuples;
+	size_t outer_beg = (query->outer_tuples / threads) * (thread + 0);
+	size_t outer_end = (query->outer_tuples / threads) * (thread + 1);
+	if (thread + 1 == threads)
+		outer_end = query->outer_tuples;
+
+	/*first pass: histograms of own chunk*/
+	for (i = inner_beg; i != inner_end; ++i)
+		inner_hist[hash_bits((uint32_t)
+				     (query->inner_keys[i] * BIG_NUMBER),
+				     0, bits_1)]++;
+	for (i = outer_beg; i != outer_end; ++i)
+		outer_hist[hash_bits((uint32_t)
+				     (query->outer_keys[i] * BIG_NUMBER),
+				     0, bits_1)]++;
+	pthread_barrier_wait(&query->barrier);
+
+	/*first pass: output offsets of this thread in every partition*/
+	size_t *inner_dst = (size_t *) malloc(partitions * sizeof(size_t));
+	size_t *outer_dst = (size_t *) malloc(partitions * sizeof(size_t));
+	assert(inner_dst != NULL && outer_dst != NULL);
+	size_t inner_off = 0, outer_off = 0;
+	for (p = 0; p != partitions; ++p) {
+		if (thread == 0) {
+			query->inner_offs[p] = inner_off;
+			query->outer_offs[p] = outer_off;
+		}
+		for (t = 0; t != threads; ++t) {
+			if (t == thread) {
+				inner_dst[p] = inner_off;
+				outer_dst[p] = outer_off;
+			}
+			inner_off += query->inner_hist[t * partitions + p];
+			outer_off += query->outer_hist[t * partitions + p];
+		}
+	}
+	if (thread == 0) {
+		query->inner_offs[partitions] = inner_off;
+		query->outer_offs[partitions] = outer_off;
+	}
+
+	/*first pass: scatter own chunk*/
+	for (i = inner_beg; i != inner_end; ++i) {
+		uint32_t key = query->inner_keys[i];
+		p = hash_bits((uint32_t) (key * BIG_NUMBER), 0, bits_1);
+		bucket_t *dst = &query->inner_part[inner_dst[p]++];
+		dst->key = key;
+		dst->val = query->inner_vals[i];
+	}
+	for (i = outer_beg; i != outer_end; ++i) {
+		uint32_t key = query->outer_keys[i];
+		p = hash_bits((uint32_t) (key * BIG_NUMBER), 0, bits_1);
+		outer_tuple_t *dst = &query->outer_part[outer_dst[p]++];
+		dst->key = key;
+		dst->val = query->outer_vals[i];
+		dst->aggr_key = outer_aggr_keys ? outer_aggr_keys[i] : 0;
+	}
+	free(inner_dst);
+	free(outer_dst);
+	pthread_barrier_wait(&query->barrier);
+
+	/*second pass and join: hand out first pass partitions dynamically*/
+	size_t sub_partitions = ((size_t) 1) << query->bits_2;
+	size_t *inner_offs = (size_t *)
+		malloc((sub_partitions + 1) * sizeof(size_t));
+	size_t *outer_offs = (size_t *)
+		malloc((sub_partitions + 1) * sizeof(size_t));
+	assert(inner_offs != NULL && outer_offs != NULL);
+	bucket_t *inner_buf = NULL, *table = NULL;
+	outer_tuple_t *outer_buf = NULL;
+	size_t inner_cap = 0, outer_cap = 0, table_buckets = 0;
+	aggr_table_t aggr;
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	aggr_table_init(&aggr, 10);
+	for (;;) {
+		p = __sync_fetch_and_add(&query->next_partition, 1);
+		if (p >= partitions)
+			break;
+		const bucket_t *inner = &query->inner_part[query->inner_offs[p]];
+		size_t inner_tuples =
+			query->inner_offs[p + 1] - query->inner_offs[p];
+		const outer_tuple_t *outer =
+			&query->outer_part[query->outer_offs[p]];
+		size_t outer_tuples =
+			query->outer_offs[p + 1] - query->outer_offs[p];
+		if (query->bits_2 == 0)
+			join_partition(query, inner, inner_tuples,
+				       outer, outer_tuples,
+				       &table, &table_buckets,
+				       &aggr, &sum, &count);
+		else
+			partition_and_join(query, inner, inner_tuples,
+					   outer, outer_tuples,
+					   &inner_buf, &inner_cap,
+					   &outer_buf, &outer_cap,
+					   inner_offs, outer_offs,
+					   &table, &table_buckets,
+					   &aggr, &sum, &count);
+	}
+	free(inner_offs);
+	free(outer_offs);
+	free(inner_buf);
+	free(outer_buf);
+	free(table);
+
+	if (outer_aggr_keys == NULL) {
+		aggr_table_free(&aggr);
+		info->sum = sum;
+		info->count = count;
+		pthread_exit(NULL);
+	}
+
+	/*exchange groups and merge the partitions claimed by this thread*/
+	for (i = 0; i != aggr.buckets; ++i)
+		if (aggr.table[i].aggr_key != 0)
+			aggr_exchange_add(&query->exchange, thread,
+					  aggr.table[i].aggr_key,
+					  aggr.table[i].count,
+					  aggr_bucket_sum(&aggr.table[i]));
+	aggr_table_free(&aggr);
+	pthread_barrier_wait(&query->barrier);
+	aggr_exchange_merge(&query->exchange, &sum, &count);
+	info->sum = sum;
+	info->count = count;
+	pthread_exit(NULL);
+}
+
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	int t, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+
+	/* pick the radix bits so that every final inner partition has
+	 * about PARTITION_TUPLES tuples; use a second pass when a single
+	 * pass would need more than 2^PASS_BITS output streams
+	 */
+	int8_t radix_bits = 0;
+	while (radix_bits < MAX_RADIX_BITS &&
+	       (inner_tuples >> radix_bits) > PARTITION_TUPLES)
+		radix_bits++;
+
+	radix_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.threads = threads;
+	query.inner_tuples = inner_tuples;
+	query.outer_tuples = outer_tuples;
+	query.inner_keys = inner_keys;
+	query.inner_vals = inner_vals;
+	query.outer_keys = outer_join_keys;
+	query.outer_vals = outer_vals;
+	query.outer_aggr_keys = outer_aggr_keys;
+	query.bits_1 = radix_bits > PASS_BITS ?
+		(radix_bits + 1) / 2 : radix_bits;
+	assert(query.bits_1 <= PASS_BITS &&
+	       radix_bits - query.bits_1 <= PASS_BITS);
+	query.bits_2 = radix_bits - query.bits_1;
+	query.partitions = ((size_t) 1) << query.bits_1;
+	query.inner_hist = (size_t *)
+		calloc(threads * query.partitions, sizeof(size_t));
+	query.outer_hist = (size_t *)
+		calloc(threads * query.partitions, sizeof(size_t));
+	query.inner_offs = (size_t *)
+		malloc((query.partitions + 1) * sizeof(size_t));
+	query.outer_offs = (size_t *)
+		malloc((query.partitions + 1) * sizeof(size_t));
+	query.inner_part = (bucket_t *)
+		malloc(inner_tuples * sizeof(bucket_t));
+	query.outer_part = (outer_tuple_t *)
+		malloc(outer_tuples * sizeof(outer_tuple_t));
+	aggr_exchange_init(&query.exchange, threads);
+	assert(query.inner_hist != NULL && query.outer_hist != NULL);
+	assert(query.inner_offs != NULL && query.outer_offs != NULL);
+	assert(query.inner_part != NULL && query.outer_part != NULL);
+	pthread_barrier_init(&query.barrier, NULL, threads);
+
+	/*create worker threads;*/
+	thread_info_t *info = (thread_info_t *)
+		malloc(threads * sizeof(thread_info_t));
+	assert(info != NULL);
+	for (t = 0; t != threads; ++t) {
+		info[t].thread = t;
+		info[t].query = &query;
+		pthread_create(&info[t].id, NULL, radix_thread, &info[t]);
+	}
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	/*aggregate result*/
+	for (t = 0; t != threads; ++t) {
+		pthread_join(info[t].id, NULL);
+		sum += info[t].sum;
+		count += info[t].count;
+	}
+	aggr_exchange_free(&query.exchange);
+	pthread_barrier_destroy(&query.barrier);
+	free(query.inner_hist);
+	free(query.outer_hist);
+	free(query.inner_offs);
+	free(query.outer_offs);
+	free(query.inner_part);
+	free(query.outer_part);
+	free(info);
+	return (uint64_t) (sum / count);
+}
@@ -0,0 +1,384 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "q4112_index.h"
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+#include "q4112_select.h"
+
+/* outer tuples probed per call of the probe kernel */
+#define PROBE_BLOCK 1024
+/* initial group table of every thread; it grows when needed */
+#define LOG_GROUP_BUCKETS 10
+
+typedef struct {
+	uint32_t store_id;
+	select_value_t value;
+	uint64_t tuples;
+} select_group_t;
+
+/* thread private group table, grown at 2/3 fill like aggr_table_t */
+typedef struct {
+	select_group_t *table;
+	int8_t log_buckets;
+	size_t buckets;
+	size_t used;
+} select_table_t;
+
+/* partial result of one thread */
+typedef struct {
+	select_value_t value;
+	uint64_t tuples;
+	select_table_t groups;
+} select_state_t;
+
+typedef struct select_query select_query_t;
+
+/* aggregates the matches of one block */
+typedef void (*select_kernel_t)(select_query_t *query, select_state_t *state,
+				size_t matches, const uint32_t *prices,
+				const uint32_t *quantities,
+				const uint32_t *store_ids);
+
+struct select_query {
+	const q4112_select_t *select;
+	q4112_index_t *index;
+	const uint32_t *outer_keys;
+	const uint32_t *outer_aggr_keys;
+	const uint32_t *outer_vals;
+	select_kernel_t kernel;
+	select_state_t *states;
+	morsel_cursor_t cursor;
+};
+
+static const char *aggregate_names[AGGS] = {
+	"sum", "count", "min", "max", "avg"
+};
+
+const char *aggregate_name(int aggregate)
+{
+	assert(aggregate >= 0 && aggregate < AGGS);
+	return aggregate_names[aggregate];
+}
+
+void select_init(q4112_select_t *select, int aggregate, int grouped)
+{
+	select->aggregate = aggregate;
+	select->grouped = grouped;
+	select->quantity_min = 0;
+	select->quantity_max = UINT32_MAX;
+	select->price_min = 0;
+	select->price_max = UINT32_MAX;
+}
+
+/*
+ * the aggregate is a constant in every kernel, so these fold to the one
+ * operation of the kernel's aggregate
+ */
+static inline __attribute__((always_inline))
+select_value_t aggregate_start(int aggregate)
+{
+	return aggregate == AGG_MIN ? UINT64_MAX : 0;
+}
+
+static inline __attribute__((always_inline))
+void aggregate_add(int aggregate, select_value_t *value, uint64_t *tuples,
+		   select_value_t val, uint64_t count)
+{
+	switch (aggregate) {
+	case AGG_MIN:
+		*value = val < *value ? val : *value;
+		break;
+	case AGG_MAX:
+		*value = val > *value ? val : *value;
+		break;
+	case AGG_SUM:
+	case AGG_AVG:
+		*value += val;
+		break;
+	}
+	*tuples += count;
+}
+
+static void select_table_init(select_table_t *groups, int8_t log_buckets)
+{
+	groups->log_buckets = log_buckets;
+	groups->buckets = ((size_t) 1) << log_buckets;
+	groups->used = 0;
+	groups->table = (select_group_t *)
+		calloc(groups->buckets, sizeof(select_group_t));
+	assert(groups->table != NULL);
+}
+
+static void select_table_grow(select_table_t *groups);
+
+/* the group of store_id, added with the empty value if it is new */
+static inline __attribute__((always_inline))
+select_group_t *select_table_find(select_table_t *groups, int aggregate,
+				  uint32_t store_id)
+{
+	uint32_t h = (uint32_t) (store_id * BIG_NUMBER);
+	h >>= 32 - groups->log_buckets;
+	while (groups->table[h].store_id != store_id) {
+		if (groups->table[h].store_id == 0) {
+			if ((groups->used + 1) * 3 > groups->buckets * 2) {
+				/*rehash and look again in the bigger table*/
+				select_table_grow(groups);
+				h = (uint32_t) (store_id * BIG_NUMBER);
+				h >>= 32 - groups->log_buckets;
+				continue;
+			}
+			groups->table[h].store_id = store_id;
+			groups->table[h].value = aggregate_start(aggregate);
+			groups->used++;
+			break;
+		}
+		h = (h + 1) & (groups->buckets - 1);
+	}
+	return &groups->table[h];
+}
+
+static void select_table_grow(select_table_t *groups)
+{
+	select_table_t bigger;
+	size_t i, h;
+	select_table_init(&bigger, groups->log_buckets + 1);
+	for (i = 0; i != groups->buckets; ++i) {
+		if (groups->table[i].store_id == 0)
+			continue;
+		h = (uint32_t) (groups->table[i].store_id * BIG_NUMBER);
+		h >>= 32 - bigger.log_buckets;
+		while (bigger.table[h].store_id != 0)
+			h = (h + 1) & (bigger.buckets - 1);
+		bigger.table[h] = groups->table[i];
+	}
+	bigger.used = groups->used;
+	free(groups->table);
+	*groups = bigger;
+}
+
+/*
+ * one kernel per aggregate, grouping and predicate; all three are
+ * constants, so the loop only has the branches of its own combination
+ */
+#define SELECT_KERNEL(name, aggregate, grouped, filtered)		\
+static void name(select_query_t *query, select_state_t *state,		\
+		 size_t matches, const uint32_t *prices,		\
+		 const uint32_t *quantities, const uint32_t *store_ids)	\
+{									\
+	const q4112_select_t *select = query->select;			\
+	uint32_t quantity_range = select->quantity_max -		\
+		select->quantity_min;					\
+	uint32_t price_range = select->price_max - select->price_min;	\
+	select_value_t value = state->value;				\
+	uint64_t tuples = state->tuples;				\
+	size_t m;							\
+	for (m = 0; m != matches; ++m) {				\
+		if ((filtered) &&					\
+		    (quantities[m] - select->quantity_min >		\
+		     quantity_range ||					\
+		     prices[m] - select->price_min > price_range))	\
+			continue;					\
+		uint64_t val = prices[m] * (uint64_t) quantities[m];	\
+		if (grouped) {						\
+			select_group_t *group =				\
+				select_table_find(&state->groups,	\
+						  aggregate,		\
+						  store_ids[m]);	\
+			aggregate_add(aggregate, &group->value,		\
+				      &group->tuples, val, 1);		\
+		} else {						\
+			aggregate_add(aggregate, &value, &tuples,	\
+				      val, 1);				\
+		}							\
+	}								\
+	state->value = value;						\
+	state->tuples = tuples;						\
+}
+
+#define SELECT_KERNELS(agg, aggregate)					\
+	SELECT_KERNEL(select_##agg, aggregate, 0, 0)			\
+	SELECT_KERNEL(select_##agg##_where, aggregate, 0, 1)		\
+	SELECT_KERNEL(select_##agg##_grouped, aggregate, 1, 0)		\
+	SELECT_KERNEL(select_##agg##_grouped_where, aggregate, 1, 1)
+
+SELECT_KERNELS(sum, AGG_SUM)
+SELECT_KERNELS(count, AGG_COUNT)
+SELECT_KERNELS(min, AGG_MIN)
+SELECT_KERNELS(max, AGG_MAX)
+SELECT_KERNELS(avg, AGG_AVG)
+
+#define SELECT_ROW(agg)							\
+	{ { select_##agg, select_##agg##_where },			\
+	  { select_##agg##_grouped, select_##agg##_grouped_where } }
+
+/* [aggregate][grouped][filtered] */
+static const select_kernel_t select_kernels[AGGS][2][2] = {
+	SELECT_ROW(sum), SELECT_ROW(count), SELECT_ROW(min),
+	SELECT_ROW(max), SELECT_ROW(avg)
+};
+
+static void select_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	select_query_t *query = (select_query_t *) arg;
+	select_state_t *state = &query->states[thread];
+	const q4112_index_t *index = query->index;
+	const probe_kernel_t *probe = probe_kernel();
+	uint32_t sel[PROBE_BLOCK];
+	uint32_t prices[PROBE_BLOCK];
+	uint32_t quantities[PROBE_BLOCK];
+	uint32_t store_ids[PROBE_BLOCK];
+	size_t beg, end, o, m, matches;
+	while (morsel_next(&query->cursor, &beg, &end)) {
+		for (o = beg; o < end; o += PROBE_BLOCK) {
+			size_t n = end - o < PROBE_BLOCK ? end - o : PROBE_BLOCK;
+			matches = probe->block(index->table, index->log_buckets,
+					       &query->outer_keys[o], n,
+					       sel, prices);
+			for (m = 0; m != matches; ++m)
+				quantities[m] = query->outer_vals[o + sel[m]];
+			if (query->select->grouped)
+				for (m = 0; m != matches; ++m)
+					store_ids[m] =
+						query->outer_aggr_keys[o + sel[m]];
+			query->kernel(query, state, matches, prices,
+				      quantities, store_ids);
+		}
+	}
+}
+
+static int row_compare(const void *a, const void *b)
+{
+	uint32_t x = ((const q4112_row_t *) a)->store_id;
+	uint32_t y = ((const q4112_row_t *) b)->store_id;
+	return x < y ? -1 : x > y;
+}
+
+/* the output value of a group from its partial value */
+static select_value_t aggregate_value(int aggregate, select_value_t value,
+				      uint64_t tuples)
+{
+	if (tuples == 0)
+		return 0;
+	if (aggregate == AGG_COUNT)
+		return tuples;
+	if (aggregate == AGG_AVG)
+		return value / tuples;
+	return value;
+}
+
+/* merge the partial results of all threads into rows */
+static void select_merge(const q4112_select_t *select, select_state_t *states,
+			 int threads, q4112_result_t *result)
+{
+	int aggregate = select->aggregate, t;
+	size_t i;
+	if (!select->grouped) {
+		select_value_t value = aggregate_start(aggregate);
+		uint64_t tuples = 0;
+		for (t = 0; t != threads; ++t)
+			aggregate_add(aggregate, &value, &tuples,
+				      states[t].value, states[t].tuples);
+		result->rows = (q4112_row_t *) malloc(sizeof(q4112_row_t));
+		assert(result->rows != NULL);
+		result->n_rows = 1;
+		result->rows[0].store_id = 0;
+		result->rows[0].value = aggregate_value(aggregate, value,
+							tuples);
+		result->rows[0].tuples = tuples;
+		return;
+	}
+	select_table_t merged;
+	size_t used = 0;
+	int8_t log_buckets = LOG_GROUP_BUCKETS;
+	for (t = 0; t != threads; ++t)
+		used += states[t].groups.used;
+	while ((((size_t) 1) << log_buckets) * 0.67 < used)
+		log_buckets++;
+	select_table_init(&merged, log_buckets);
+	for (t = 0; t != threads; ++t) {
+		const select_table_t *groups = &states[t].groups;
+		for (i = 0; i != groups->buckets; ++i) {
+			if (groups->table[i].store_id == 0)
+				continue;
+			select_group_t *group =
+				select_table_find(&merged, aggregate,
+						  groups->table[i].store_id);
+			aggregate_add(aggregate, &group->value, &group->tuples,
+				      groups->table[i].value,
+				      groups->table[i].tuples);
+		}
+	}
+	result->rows = (q4112_row_t *)
+		malloc((merged.used + 1) * sizeof(q4112_row_t));
+	assert(result->rows != NULL);
+	result->n_rows = 0;
+	for (i = 0; i != merged.buckets; ++i) {
+		const select_group_t *group = &merged.table[i];
+		if (group->store_id == 0)
+			continue;
+		q4112_row_t *row = &result->rows[result->n_rows++];
+		row->store_id = group->store_id;
+		row->value = aggregate_value(aggregate, group->value,
+					     group->tuples);
+		row->tuples = group->tuples;
+	}
+	free(merged.table);
+	qsort(result->rows, result->n_rows, sizeof(q4112_row_t), row_compare);
+}
+
+void q4112_select(const q4112_select_t *select,
+		  const uint32_t *inner_keys, const uint32_t *inner_vals,
+		  size_t inner_tuples, const uint32_t *outer_join_keys,
+		  const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		  size_t outer_tuples, int threads, q4112_result_t *result)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	assert(select->aggregate >= 0 && select->aggregate < AGGS);
+	assert(select->quantity_min <= select->quantity_max);
+	assert(select->price_min <= select->price_max);
+	assert(outer_aggr_keys != NULL || !select->grouped);
+	int t, filtered = select->quantity_min != 0 ||
+		select->quantity_max != UINT32_MAX ||
+		select->price_min != 0 || select->price_max != UINT32_MAX;
+
+	select_query_t query;
+	query.select = select;
+	query.index = index_build(inner_keys, inner_vals, inner_tuples,
+				  threads);
+	query.outer_keys = outer_join_keys;
+	query.outer_aggr_keys = outer_aggr_keys;
+	query.outer_vals = outer_vals;
+	query.kernel = select_kernels[select->aggregate]
+		[select->grouped != 0][filtered];
+	query.states = (select_state_t *)
+		calloc(threads, sizeof(select_state_t));
+	assert(query.states != NULL);
+	for (t = 0; t != threads; ++t) {
+		query.states[t].value = aggregate_start(select->aggregate);
+		if (select->grouped)
+			select_table_init(&query.states[t].groups,
+					  LOG_GROUP_BUCKETS);
+	}
+	morsel_init(&query.cursor, 0, outer_tuples);
+
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_run(pool, select_thread, &query);
+	pool_release(pool);
+
+	select_merge(select, query.states, threads, result);
+	for (t = 0; t != threads; ++t)
+		free(query.states[t].groups.table);
+	free(query.states);
+	index_free(query.index);
+}
+
+void result_free(q4112_result_t *result)
+{
+	free(result->rows);
+	result->rows = NULL;
+	result->n_rows = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef _Q4112_SELECT_
+#define _Q4112_SELECT_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* aggregate functions over items.price * orders.quantity */
+#define AGG_SUM 0
+#define AGG_COUNT 1
+#define AGG_MIN 2
+#define AGG_MAX 3
+#define AGG_AVG 4
+#define AGGS 5
+
+/* SUM over billions of orders passes 2^64 */
+typedef unsigned __int128 select_value_t;
+
+/*
+ * SELECT [orders.store_id,] aggregate(items.price * orders.quantity)
+ * FROM orders JOIN items WHERE quantity and price in their (inclusive)
+ * ranges [GROUP BY orders.store_id]
+ */
+typedef struct {
+	int aggregate;
+	int grouped;
+	uint32_t quantity_min;
+	uint32_t quantity_max;
+	uint32_t price_min;
+	uint32_t price_max;
+} q4112_select_t;
+
+/* the select without a predicate */
+void select_init(q4112_select_t *select, int aggregate, int grouped);
+
+/* "sum", "count", "min", "max" or "avg" */
+const char *aggregate_name(int aggregate);
+
+typedef struct {
+	/* 0 in the row of a global aggregate */
+	uint32_t store_id;
+	/* the aggregate; AVG is rounded down like q4112_run */
+	select_value_t value;
+	/* joined orders that passed the predicate */
+	uint64_t tuples;
+} q4112_row_t;
+
+typedef struct {
+	q4112_row_t *rows;
+	size_t n_rows;
+} q4112_result_t;
+
+/*
+ * run the select on the hash join; grouped results have one row per
+ * store in store_id order, global results always have one row (with
+ * tuples 0 and value 0 if no order joins); outer_aggr_keys may be NULL
+ * unless the select is grouped
+ */
+void q4112_select(const q4112_select_t *select,
+		  const uint32_t *inner_keys, const uint32_t *inner_vals,
+		  size_t inner_tuples, const uint32_t *outer_join_keys,
+		  const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		  size_t outer_tuples, int threads, q4112_result_t *result);
+
+void result_free(q4112_result_t *result);
+
+#endif
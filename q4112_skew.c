@@ -0,0 +1,417 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112_aggr.h"
+#include "q4112_col.h"
+#include "q4112_pool.h"
+#include "q4112_skew.h"
+
+/* odd multipliers make the ids a bijection of the indexes, never 0 */
+#define ITEM_NUMBER 0x9e3779b1u
+#define STORE_NUMBER 0x85ebca77u
+
+/* primes that spread popularity ranks over the indexes */
+#define RANK_STEP 2654435761u
+#define RANK_STEP_ALT 2246822519u
+
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ull
+
+/* tuples per column write of a file and per local result update */
+#define SKEW_BLOCK (1 << 14)
+
+#define LOG_GROUP_BUCKETS 10
+
+/*
+ * Zipf sampler over the ranks 1..n by rejection inversion (Hörmann and
+ * Derflinger): constant time per sample for any n, exponent 0 is uniform
+ */
+typedef struct {
+	double s;
+	uint64_t n;
+	double h_x1;
+	double h_n;
+	double cut;
+} zipf_t;
+
+typedef struct {
+	const skew_spec_t *spec;
+	size_t referenced;
+	uint64_t item_step;
+	uint64_t store_step;
+	uint64_t items_seed;
+	uint64_t orders_seed;
+	zipf_t items;
+	zipf_t stores;
+	uint32_t *inner_keys;
+	uint32_t *inner_vals;
+	/* NULL when streaming into a file */
+	uint32_t *outer_join_keys;
+	uint32_t *outer_aggr_keys;
+	uint32_t *outer_vals;
+	/* column file, -1 for arrays */
+	int fd;
+	uint64_t offsets[COL_COLUMNS];
+	/* first errno of a failed write */
+	int error;
+	morsel_cursor_t inner_cursor;
+	morsel_cursor_t outer_cursor;
+	aggr_exchange_t exchange;
+	aggr_sum_t *sums;
+	uint64_t *counts;
+} skew_t;
+
+void skew_spec_init(skew_spec_t *spec)
+{
+	memset(spec, 0, sizeof(*spec));
+	spec->inner_tuples = 1000;
+	spec->inner_selectivity = 1.0;
+	spec->inner_val_max = 10000000;
+	spec->outer_tuples = 1000000;
+	spec->outer_selectivity = 1.0;
+	spec->outer_val_max = 1000;
+	spec->seed = 4112;
+}
+
+static inline uint64_t mix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+/* splitmix64 */
+static inline uint64_t rng_next(uint64_t *state)
+{
+	*state += GOLDEN_GAMMA;
+	return mix64(*state);
+}
+
+/* the generator of a tuple depends on the seed and its position only */
+static inline uint64_t rng_tuple(uint64_t seed, size_t tuple)
+{
+	return mix64(seed ^ mix64(tuple));
+}
+
+/* uniform in [0, n) */
+static inline uint64_t rng_below(uint64_t *state, uint64_t n)
+{
+	return (uint64_t) (((unsigned __int128) rng_next(state) * n) >> 64);
+}
+
+/* uniform in [0, 1) */
+static inline double rng_double(uint64_t *state)
+{
+	return (rng_next(state) >> 11) * 0x1.0p-53;
+}
+
+static inline double zipf_helper1(double x)
+{
+	if (fabs(x) > 1e-8)
+		return log1p(x) / x;
+	return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static inline double zipf_helper2(double x)
+{
+	if (fabs(x) > 1e-8)
+		return expm1(x) / x;
+	return 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+static inline double zipf_h(const zipf_t *zipf, double x)
+{
+	return exp(-zipf->s * log(x));
+}
+
+static inline double zipf_h_integral(const zipf_t *zipf, double x)
+{
+	double log_x = log(x);
+	return zipf_helper2((1 - zipf->s) * log_x) * log_x;
+}
+
+static inline double zipf_h_integral_inverse(const zipf_t *zipf, double x)
+{
+	double t = x * (1 - zipf->s);
+	if (t < -1)
+		t = -1;
+	return exp(zipf_helper1(t) * x);
+}
+
+static void zipf_init(zipf_t *zipf, uint64_t n, double s)
+{
+	assert(n > 0 && s >= 0);
+	zipf->s = s;
+	zipf->n = n;
+	if (s == 0)
+		return;
+	zipf->h_x1 = zipf_h_integral(zipf, 1.5) - 1;
+	zipf->h_n = zipf_h_integral(zipf, n + 0.5);
+	zipf->cut = 2 - zipf_h_integral_inverse(
+		zipf, zipf_h_integral(zipf, 2.5) - zipf_h(zipf, 2));
+}
+
+/* rank in [0, n), 0 the most popular */
+static inline uint64_t zipf_next(const zipf_t *zipf, uint64_t *state)
+{
+	if (zipf->s == 0)
+		return rng_below(state, zipf->n);
+	for (;;) {
+		double u = zipf->h_n + rng_double(state) *
+			(zipf->h_x1 - zipf->h_n);
+		double x = zipf_h_integral_inverse(zipf, u);
+		double k = floor(x + 0.5);
+		if (k < 1)
+			k = 1;
+		else if (k > zipf->n)
+			k = zipf->n;
+		if (k - x <= zipf->cut ||
+		    u >= zipf_h_integral(zipf, k + 0.5) - zipf_h(zipf, k))
+			return (uint64_t) k - 1;
+	}
+}
+
+/* a multiplier that permutes [0, n) */
+static uint64_t rank_step(size_t n)
+{
+	return n % RANK_STEP == 0 ? RANK_STEP_ALT : RANK_STEP;
+}
+
+static inline uint32_t item_id(uint64_t index)
+{
+	return (uint32_t) ((index + 1) * ITEM_NUMBER);
+}
+
+static inline uint32_t store_id(uint64_t index)
+{
+	return (uint32_t) ((index + 1) * STORE_NUMBER);
+}
+
+static void skew_write(skew_t *skew, int column, const uint32_t *data,
+		       size_t beg, size_t n)
+{
+	if (skew->fd < 0 || skew->error != 0)
+		return;
+	if (col_pwrite(skew->fd, data, n * sizeof(uint32_t),
+		       skew->offsets[column] + beg * sizeof(uint32_t)) != 0)
+		__sync_bool_compare_and_swap(&skew->error, 0,
+					     errno ? errno : EIO);
+}
+
+static void skew_items(skew_t *skew, size_t beg, size_t end)
+{
+	uint32_t val_max = skew->spec->inner_val_max;
+	size_t i;
+	for (i = beg; i != end; ++i) {
+		uint64_t rng = rng_tuple(skew->items_seed, i);
+		skew->inner_keys[i] = item_id(i);
+		skew->inner_vals[i] = 1 + rng_below(&rng, val_max);
+	}
+	skew_write(skew, COL_ITEMS_ID, &skew->inner_keys[beg], beg, end - beg);
+	skew_write(skew, COL_ITEMS_PRICE, &skew->inner_vals[beg], beg,
+		   end - beg);
+}
+
+/*
+ * orders [beg, beg + n) into the three columns and their partial result;
+ * an order misses items with an id of an index past the items
+ */
+static void skew_orders(skew_t *skew, size_t beg, size_t n,
+			uint32_t *join_keys, uint32_t *aggr_keys,
+			uint32_t *vals, aggr_table_t *groups,
+			aggr_sum_t *sum, uint64_t *count)
+{
+	const skew_spec_t *spec = skew->spec;
+	size_t inner_tuples = spec->inner_tuples;
+	uint64_t missing = UINT32_MAX - inner_tuples;
+	aggr_sum_t s = 0;
+	uint64_t c = 0;
+	size_t i;
+	for (i = 0; i != n; ++i) {
+		uint64_t rng = rng_tuple(skew->orders_seed, beg + i);
+		int match = rng_double(&rng) < spec->outer_selectivity;
+		uint64_t rank = 0, index;
+		if (match) {
+			rank = zipf_next(&skew->items, &rng);
+			index = rank * skew->item_step % inner_tuples;
+		} else {
+			index = inner_tuples + rng_below(&rng, missing);
+		}
+		join_keys[i] = item_id(index);
+		uint32_t store = 0;
+		if (aggr_keys != NULL) {
+			uint64_t store_rank;
+			if (match && rng_double(&rng) < spec->correlation)
+				store_rank = rank * spec->groups /
+					skew->referenced;
+			else
+				store_rank = zipf_next(&skew->stores, &rng);
+			store = store_id(store_rank * skew->store_step %
+					 spec->groups);
+			aggr_keys[i] = store;
+		}
+		vals[i] = 1 + rng_below(&rng, spec->outer_val_max);
+		if (!match)
+			continue;
+		uint64_t product = skew->inner_vals[index] * (uint64_t) vals[i];
+		if (aggr_keys != NULL) {
+			aggr_table_update(groups, store, 1, product);
+		} else {
+			s += product;
+			c += 1;
+		}
+	}
+	*sum += s;
+	*count += c;
+}
+
+static void skew_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	skew_t *skew = (skew_t *) arg;
+	int grouped = skew->spec->groups != 0;
+	size_t beg, end, b;
+	while (morsel_next(&skew->inner_cursor, &beg, &end))
+		skew_items(skew, beg, end);
+	/*the orders look up the prices*/
+	pool_barrier(pool, thread);
+
+	uint32_t *join_keys = NULL, *aggr_keys = NULL, *vals = NULL;
+	if (skew->fd >= 0) {
+		join_keys = pool_alloc(pool, thread,
+				       SKEW_BLOCK * sizeof(uint32_t));
+		vals = pool_alloc(pool, thread, SKEW_BLOCK * sizeof(uint32_t));
+		if (grouped)
+			aggr_keys = pool_alloc(pool, thread,
+					       SKEW_BLOCK * sizeof(uint32_t));
+	}
+	aggr_table_t groups;
+	if (grouped)
+		aggr_table_init(&groups, LOG_GROUP_BUCKETS);
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	while (morsel_next(&skew->outer_cursor, &beg, &end)) {
+		for (b = beg; b < end; b += SKEW_BLOCK) {
+			size_t n = end - b < SKEW_BLOCK ? end - b : SKEW_BLOCK;
+			if (skew->fd < 0) {
+				join_keys = &skew->outer_join_keys[b];
+				vals = &skew->outer_vals[b];
+				if (grouped)
+					aggr_keys = &skew->outer_aggr_keys[b];
+			}
+			skew_orders(skew, b, n, join_keys, aggr_keys, vals,
+				    &groups, &sum, &count);
+			skew_write(skew, COL_ORDERS_ITEM_ID, join_keys, b, n);
+			if (grouped)
+				skew_write(skew, COL_ORDERS_STORE_ID, aggr_keys,
+					   b, n);
+			skew_write(skew, COL_ORDERS_QUANTITY, vals, b, n);
+		}
+	}
+	if (grouped) {
+		for (b = 0; b != groups.buckets; ++b)
+			if (groups.table[b].aggr_key != 0)
+				aggr_exchange_add(&skew->exchange, thread,
+						  groups.table[b].aggr_key,
+						  groups.table[b].count,
+						  aggr_bucket_sum(&groups.table[b]));
+		aggr_table_free(&groups);
+		pool_barrier(pool, thread);
+		aggr_exchange_merge(&skew->exchange, &sum, &count);
+	}
+	skew->sums[thread] = sum;
+	skew->counts[thread] = count;
+}
+
+static uint64_t skew_run(skew_t *skew, int threads)
+{
+	const skew_spec_t *spec = skew->spec;
+	int t;
+	assert(threads > 0);
+	assert(spec->inner_tuples > 0 && spec->inner_tuples < UINT32_MAX);
+	assert(spec->inner_selectivity > 0 && spec->inner_selectivity <= 1);
+	assert(spec->outer_selectivity >= 0 && spec->outer_selectivity <= 1);
+	assert(spec->inner_val_max > 0 && spec->outer_val_max > 0);
+	assert(spec->groups < UINT32_MAX);
+	assert(spec->correlation >= 0 && spec->correlation <= 1);
+	skew->referenced = ceil(spec->inner_tuples * spec->inner_selectivity);
+	if (skew->referenced > spec->inner_tuples)
+		skew->referenced = spec->inner_tuples;
+	skew->item_step = rank_step(spec->inner_tuples);
+	skew->store_step = rank_step(spec->groups);
+	skew->items_seed = mix64(spec->seed + GOLDEN_GAMMA);
+	skew->orders_seed = mix64(spec->seed + 2 * GOLDEN_GAMMA);
+	zipf_init(&skew->items, skew->referenced, spec->item_zipf);
+	if (spec->groups != 0)
+		zipf_init(&skew->stores, spec->groups, spec->store_zipf);
+	skew->error = 0;
+	morsel_init(&skew->inner_cursor, 0, spec->inner_tuples);
+	morsel_init(&skew->outer_cursor, 0, spec->outer_tuples);
+	aggr_exchange_init(&skew->exchange, threads);
+	skew->sums = (aggr_sum_t *) calloc(threads, sizeof(aggr_sum_t));
+	skew->counts = (uint64_t *) calloc(threads, sizeof(uint64_t));
+	assert(skew->sums != NULL && skew->counts != NULL);
+
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_run(pool, skew_thread, skew);
+	pool_release(pool);
+
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	for (t = 0; t != threads; ++t) {
+		sum += skew->sums[t];
+		count += skew->counts[t];
+	}
+	aggr_exchange_free(&skew->exchange);
+	free(skew->sums);
+	free(skew->counts);
+	return count ? (uint64_t) (sum / count) : 0;
+}
+
+uint64_t skew_gen(const skew_spec_t *spec,
+		  uint32_t *inner_keys, uint32_t *inner_vals,
+		  uint32_t *outer_join_keys, uint32_t *outer_aggr_keys,
+		  uint32_t *outer_vals, int threads)
+{
+	skew_t skew;
+	assert((spec->groups != 0) == (outer_aggr_keys != NULL));
+	skew.spec = spec;
+	skew.inner_keys = inner_keys;
+	skew.inner_vals = inner_vals;
+	skew.outer_join_keys = outer_join_keys;
+	skew.outer_aggr_keys = outer_aggr_keys;
+	skew.outer_vals = outer_vals;
+	skew.fd = -1;
+	return skew_run(&skew, threads);
+}
+
+int skew_gen_file(const skew_spec_t *spec, const char *path, int threads,
+		  uint64_t *result)
+{
+	skew_t skew;
+	skew.spec = spec;
+	skew.fd = col_create(path, spec->inner_tuples, spec->outer_tuples,
+			     spec->groups != 0, skew.offsets);
+	if (skew.fd < 0)
+		return -1;
+	skew.inner_keys = (uint32_t *)
+		malloc(spec->inner_tuples * sizeof(uint32_t));
+	skew.inner_vals = (uint32_t *)
+		malloc(spec->inner_tuples * sizeof(uint32_t));
+	assert(skew.inner_keys != NULL && skew.inner_vals != NULL);
+	skew.outer_join_keys = NULL;
+	skew.outer_aggr_keys = NULL;
+	skew.outer_vals = NULL;
+	*result = skew_run(&skew, threads);
+	free(skew.inner_keys);
+	free(skew.inner_vals);
+	if (skew.error != 0) {
+		close(skew.fd);
+		errno = skew.error;
+		return -1;
+	}
+	return col_finish(skew.fd, *result);
+}
@@ -0,0 +1,61 @@
+#ifndef _Q4112_SKEW_
+#define _Q4112_SKEW_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * skewed query input: orders.item_id follows a Zipf distribution over
+ * the items that are referenced, orders.store_id a Zipf distribution
+ * over the stores, and the popularity of the two can be correlated (a
+ * popular item is mostly sold by popular stores). Every tuple draws its
+ * values from a generator seeded with seed and its position, so the
+ * same spec gives the same columns for any number of threads.
+ */
+typedef struct {
+	/* tuples for table items */
+	size_t inner_tuples;
+	/* fraction of the items that orders refer to */
+	double inner_selectivity;
+	/* items.price is in [1, inner_val_max] */
+	uint32_t inner_val_max;
+	/* tuples for table orders */
+	size_t outer_tuples;
+	/* probability that orders.item_id exists in items */
+	double outer_selectivity;
+	/* orders.quantity is in [1, outer_val_max] */
+	uint32_t outer_val_max;
+	/* distinct values for orders.store_id (0 for no store column) */
+	size_t groups;
+	/* Zipf exponents of item and store popularity (0 is uniform) */
+	double item_zipf;
+	double store_zipf;
+	/*
+	 * probability that the store of an order with a matching item has
+	 * the same popularity rank (scaled to the stores) as its item
+	 */
+	double correlation;
+	uint64_t seed;
+} skew_spec_t;
+
+/* the defaults of q4112_main.c without skew */
+void skew_spec_init(skew_spec_t *spec);
+
+/*
+ * generate the columns (outer_aggr_keys NULL if groups is 0) on threads
+ * workers and return the result of the query
+ */
+uint64_t skew_gen(const skew_spec_t *spec,
+		  uint32_t *inner_keys, uint32_t *inner_vals,
+		  uint32_t *outer_join_keys, uint32_t *outer_aggr_keys,
+		  uint32_t *outer_vals, int threads);
+
+/*
+ * generate straight into a column file: only the items are kept in
+ * memory, the workers write the orders block by block; returns -1 and
+ * errno on error
+ */
+int skew_gen_file(const skew_spec_t *spec, const char *path, int threads,
+		  uint64_t *result);
+
+#endif
@@ -0,0 +1,70 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112_skew.h"
+#include "q4112_util.h"
+
+// generate a skewed query input in parallel straight into a column file
+// (file "-" generates in memory only, to time the generator)
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file [inner_tuples inner_selectivity "
+            "inner_val_max outer_tuples outer_selectivity outer_val_max "
+            "groups item_zipf store_zipf correlation seed threads]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  skew_spec_t spec;
+  skew_spec_init(&spec);
+  if (argc > 2) spec.inner_tuples = atoll(argv[2]);
+  if (argc > 3) spec.inner_selectivity = atof(argv[3]);
+  if (argc > 4) spec.inner_val_max = atoll(argv[4]);
+  if (argc > 5) spec.outer_tuples = atoll(argv[5]);
+  if (argc > 6) spec.outer_selectivity = atof(argv[6]);
+  if (argc > 7) spec.outer_val_max = atoll(argv[7]);
+  if (argc > 8) spec.groups = atoll(argv[8]);
+  if (argc > 9) spec.item_zipf = atof(argv[9]);
+  if (argc > 10) spec.store_zipf = atof(argv[10]);
+  if (argc > 11) spec.correlation = atof(argv[11]);
+  if (argc > 12) spec.seed = strtoull(argv[12], NULL, 0);
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = argc > 13 ? atoi(argv[13]) : max_threads;
+  assert(threads > 0 && threads <= max_threads);
+  assert(spec.inner_tuples > 0 && spec.outer_tuples > 0);
+  assert(spec.inner_selectivity > 0 && spec.inner_selectivity <= 1);
+  assert(spec.outer_selectivity >= 0 && spec.outer_selectivity <= 1);
+  assert(spec.item_zipf >= 0 && spec.store_zipf >= 0);
+  assert(spec.correlation >= 0 && spec.correlation <= 1);
+  uint64_t res;
+  int failed = 0;
+  uint64_t gen_ns = real_time();
+  if (strcmp(argv[1], "-") == 0) {
+    uint32_t* inner_keys = alloc_column(spec.inner_tuples, "inner keys");
+    uint32_t* inner_vals = alloc_column(spec.inner_tuples, "inner values");
+    uint32_t* outer_join_keys =
+      alloc_column(spec.outer_tuples, "outer join keys");
+    uint32_t* outer_aggr_keys = NULL;
+    if (spec.groups > 0)
+      outer_aggr_keys = alloc_column(spec.outer_tuples, "outer aggregate keys");
+    uint32_t* outer_vals = alloc_column(spec.outer_tuples, "outer values");
+    res = skew_gen(&spec, inner_keys, inner_vals, outer_join_keys,
+                   outer_aggr_keys, outer_vals, threads);
+    free(inner_keys);
+    free(inner_vals);
+    free(outer_join_keys);
+    free(outer_aggr_keys);
+    free(outer_vals);
+  } else {
+    failed = skew_gen_file(&spec, argv[1], threads, &res);
+    if (failed) perror(argv[1]);
+  }
+  gen_ns = real_time() - gen_ns;
+  if (!failed)
+    fprintf(stderr, "generated in %llu ns, result %llu\n",
+            (unsigned long long) gen_ns, (unsigned long long) res);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
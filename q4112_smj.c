@@ -0,0 +1,300 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+
+/* LSB radix sort digits: 4 passes of 8 bits over a 32-bit key */
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+/* sorted outer tuple */
+typedef struct {
+	uint32_t key;
+	uint32_t aggr_key;
+	uint32_t val;
+} smj_tuple_t;
+
+/* joined tuple sorted by group; packed to fit the buffers of the outer */
+typedef struct {
+	uint32_t aggr_key;
+	uint64_t val;
+} __attribute__((packed)) smj_match_t;
+
+/* state of one query shared by the workers of the pool */
+typedef struct {
+	int threads;
+	size_t inner_tuples;
+	size_t outer_tuples;
+	const uint32_t *inner_keys;
+	const uint32_t *inner_vals;
+	const uint32_t *outer_keys;
+	const uint32_t *outer_vals;
+	const uint32_t *outer_aggr_keys;
+	/* inner pairs and their sort buffer */
+	bucket_t *inner[2];
+	/* outer tuples; the joined tuples reuse the same two buffers */
+	void *outer[2];
+	/* digit histograms (threads x RADIX_BUCKETS), then write offsets */
+	size_t *hist;
+	int skip;
+	/* joined tuples of every thread: [match_beg, match_end) */
+	size_t *match_beg;
+	size_t *match_end;
+	size_t matches;
+	/* 128-bit sums: billions of joined tuples pass 2^64 */
+	unsigned __int128 *sums;
+	uint64_t *counts;
+} smj_query_t;
+
+static void split(size_t n, int thread, int threads, size_t *beg, size_t *end)
+{
+	*beg = (n / threads) * thread;
+	*end = thread + 1 == threads ? n : (n / threads) * (thread + 1);
+}
+
+/*
+ * thread 0 turns the digit histograms into write offsets (digit major,
+ * thread minor keeps the sort stable); a digit that holds every key
+ * makes the pass a no-op, which is skipped unless the pass has to
+ * compact scattered source ranges
+ */
+static void radix_offsets(smj_query_t *query, size_t n, int compact)
+{
+	int t, threads = query->threads;
+	size_t d, offset = 0;
+	query->skip = 0;
+	for (d = 0; d != RADIX_BUCKETS; ++d) {
+		size_t digit = 0;
+		for (t = 0; t != threads; ++t) {
+			size_t count = query->hist[t * RADIX_BUCKETS + d];
+			query->hist[t * RADIX_BUCKETS + d] = offset;
+			offset += count;
+			digit += count;
+		}
+		if (digit == n && !compact)
+			query->skip = 1;
+	}
+}
+
+/*
+ * parallel LSB radix sort of n records of type; thread reads [beg, end)
+ * of src in the first pass (the ranges may be scattered) and the sorted
+ * records end up dense in the returned buffer, src or dst
+ */
+#define SMJ_RADIX_SORT(name, type, field)				\
+static type *name(q4112_pool_t *pool, int thread, smj_query_t *query,	\
+		  type *src, type *dst, size_t n, size_t beg, size_t end,	\
+		  int compact)							\
+{									\
+	size_t *hist = &query->hist[thread * RADIX_BUCKETS];		\
+	size_t i;							\
+	int shift;							\
+	for (shift = 0; shift != 32; shift += RADIX_BITS) {		\
+		memset(hist, 0, RADIX_BUCKETS * sizeof(size_t));	\
+		for (i = beg; i != end; ++i)				\
+			hist[(src[i].field >> shift) &			\
+			     (RADIX_BUCKETS - 1)]++;			\
+		pool_barrier(pool, thread);				\
+		if (thread == 0)					\
+			radix_offsets(query, n, compact);		\
+		pool_barrier(pool, thread);				\
+		if (query->skip)					\
+			continue;					\
+		for (i = beg; i != end; ++i)				\
+			dst[hist[(src[i].field >> shift) &		\
+				 (RADIX_BUCKETS - 1)]++] = src[i];	\
+		type *tmp = src;					\
+		src = dst;						\
+		dst = tmp;						\
+		split(n, thread, query->threads, &beg, &end);		\
+		compact = 0;						\
+		/*all threads scatter before the next histogram*/	\
+		pool_barrier(pool, thread);				\
+	}								\
+	return src;							\
+}
+
+SMJ_RADIX_SORT(sort_inner, bucket_t, key)
+SMJ_RADIX_SORT(sort_outer, smj_tuple_t, key)
+SMJ_RADIX_SORT(sort_matches, smj_match_t, aggr_key)
+
+/* first position of inner with a key not below key */
+static size_t lower_bound(const bucket_t *inner, size_t n, uint32_t key)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (inner[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void worker_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	smj_query_t *query = (smj_query_t *) arg;
+	int threads = query->threads;
+	size_t inner_tuples = query->inner_tuples;
+	size_t outer_tuples = query->outer_tuples;
+	const uint32_t *outer_aggr_keys = query->outer_aggr_keys;
+	size_t beg, end, i, o;
+
+	/*copy the inputs into sortable records*/
+	split(inner_tuples, thread, threads, &beg, &end);
+	bucket_t *inner = query->inner[0];
+	for (i = beg; i != end; ++i) {
+		inner[i].key = query->inner_keys[i];
+		inner[i].val = query->inner_vals[i];
+	}
+	split(outer_tuples, thread, threads, &beg, &end);
+	smj_tuple_t *outer = (smj_tuple_t *) query->outer[0];
+	for (o = beg; o != end; ++o) {
+		outer[o].key = query->outer_keys[o];
+		outer[o].aggr_key = outer_aggr_keys ? outer_aggr_keys[o] : 0;
+		outer[o].val = query->outer_vals[o];
+	}
+
+	/*sort both tables on the join key*/
+	split(inner_tuples, thread, threads, &beg, &end);
+	inner = sort_inner(pool, thread, query, query->inner[0],
+			   query->inner[1], inner_tuples, beg, end, 0);
+	split(outer_tuples, thread, threads, &beg, &end);
+	outer = sort_outer(pool, thread, query, outer,
+			   (smj_tuple_t *) query->outer[1], outer_tuples,
+			   beg, end, 0);
+	smj_match_t *matches = (smj_match_t *)
+		(outer == query->outer[0] ? query->outer[1] : query->outer[0]);
+
+	/* merge join of the thread's outer range; the inner keys are
+	 * unique so the inner cursor only moves forward
+	 */
+	unsigned __int128 sum = 0;
+	uint64_t count = 0;
+	size_t m = beg;
+	i = beg == end ? 0 : lower_bound(inner, inner_tuples, outer[beg].key);
+	for (o = beg; o != end && i != inner_tuples; ++o) {
+		uint32_t key = outer[o].key;
+		while (i != inner_tuples && inner[i].key < key)
+			i++;
+		if (i == inner_tuples || inner[i].key != key)
+			continue;
+		uint64_t val = inner[i].val * (uint64_t) outer[o].val;
+		if (outer_aggr_keys == NULL) {
+			sum += val;
+			count += 1;
+		} else {
+			matches[m].aggr_key = outer[o].aggr_key;
+			matches[m].val = val;
+			m++;
+		}
+	}
+	if (outer_aggr_keys == NULL) {
+		query->sums[thread] = sum;
+		query->counts[thread] = count;
+		return;
+	}
+	query->match_beg[thread] = beg;
+	query->match_end[thread] = m;
+	pool_barrier(pool, thread);
+	if (thread == 0) {
+		query->matches = 0;
+		for (i = 0; i != (size_t) threads; ++i)
+			query->matches += query->match_end[i] - query->match_beg[i];
+	}
+	pool_barrier(pool, thread);
+
+	/*sort the joined tuples on the group, the outer buffer is free*/
+	matches = sort_matches(pool, thread, query, matches,
+			       (smj_match_t *) outer, query->matches,
+			       query->match_beg[thread],
+			       query->match_end[thread], 1);
+
+	/* a thread aggregates the groups that start in its range, the
+	 * last one of them may run into the next range
+	 */
+	size_t n = query->matches;
+	split(n, thread, threads, &beg, &end);
+	while (beg != 0 && beg < end &&
+	       matches[beg].aggr_key == matches[beg - 1].aggr_key)
+		beg++;
+	while (beg < end) {
+		uint32_t aggr_key = matches[beg].aggr_key;
+		unsigned __int128 group_sum = 0;
+		uint64_t group_count = 0;
+		for (; beg != n && matches[beg].aggr_key == aggr_key; ++beg) {
+			group_sum += matches[beg].val;
+			group_count += 1;
+		}
+		sum += group_sum / group_count;
+		count += 1;
+	}
+	query->sums[thread] = sum;
+	query->counts[thread] = count;
+}
+
+uint64_t q4112_run(const uint32_t *inner_keys, const uint32_t *inner_vals,
+		   size_t inner_tuples, const uint32_t *outer_join_keys,
+		   const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		   size_t outer_tuples, int threads)
+{
+	int t, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+
+	smj_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.threads = threads;
+	query.inner_tuples = inner_tuples;
+	query.outer_tuples = outer_tuples;
+	query.inner_keys = inner_keys;
+	query.inner_vals = inner_vals;
+	query.outer_keys = outer_join_keys;
+	query.outer_vals = outer_vals;
+	query.outer_aggr_keys = outer_aggr_keys;
+	for (t = 0; t != 2; ++t) {
+		query.inner[t] = (bucket_t *)
+			malloc(inner_tuples * sizeof(bucket_t));
+		query.outer[t] = malloc(outer_tuples * sizeof(smj_tuple_t));
+		assert(query.inner[t] != NULL && query.outer[t] != NULL);
+	}
+	query.hist = (size_t *)
+		malloc(threads * RADIX_BUCKETS * sizeof(size_t));
+	query.match_beg = (size_t *) calloc(threads, sizeof(size_t));
+	query.match_end = (size_t *) calloc(threads, sizeof(size_t));
+	query.sums = (unsigned __int128 *)
+		calloc(threads, sizeof(unsigned __int128));
+	query.counts = (uint64_t *) calloc(threads, sizeof(uint64_t));
+	assert(query.hist != NULL);
+	assert(query.match_beg != NULL && query.match_end != NULL);
+	assert(query.sums != NULL && query.counts != NULL);
+
+	q4112_pool_t *pool = pool_acquire(threads);
+	pool_run(pool, worker_thread, &query);
+	if (getenv("Q4112_STATS") != NULL)
+		pool_report(pool, "smj");
+	pool_release(pool);
+
+	unsigned __int128 sum = 0;
+	uint64_t count = 0;
+	/*aggregate result*/
+	for (t = 0; t != threads; ++t) {
+		sum += query.sums[t];
+		count += query.counts[t];
+	}
+	for (t = 0; t != 2; ++t) {
+		free(query.inner[t]);
+		free(query.outer[t]);
+	}
+	free(query.hist);
+	free(query.match_beg);
+	free(query.match_end);
+	free(query.sums);
+	free(query.counts);
+	return (uint64_t) (sum / count);
+}
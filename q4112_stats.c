@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "q4112_stats.h"
+
+static const char *const phase_names[PHASES] = {
+	"build", "estimate", "table", "probe", "scan"
+};
+
+static const char *const counter_names[COUNTERS] = {
+	"cycles", "instructions", "llc-misses", "dtlb-misses", "branch-misses"
+};
+
+const char *stats_phase_name(int phase)
+{
+	return phase_names[phase];
+}
+
+const char *stats_counter_name(int counter)
+{
+	return counter_names[counter];
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+void stats_init(q4112_stats_t *stats, int threads)
+{
+	stats->threads = threads;
+	stats->thread = (thread_stats_t *)
+		calloc(threads, sizeof(thread_stats_t));
+	assert(stats->thread != NULL);
+}
+
+void stats_free(q4112_stats_t *stats)
+{
+	free(stats->thread);
+	stats->thread = NULL;
+}
+
+#ifdef __linux__
+/* count the events of the calling thread on any cpu, user space only */
+static int counter_open(int counter)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	switch (counter) {
+	case COUNTER_CYCLES:
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case COUNTER_INSTRUCTIONS:
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case COUNTER_LLC_MISSES:
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case COUNTER_DTLB_MISSES:
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	default:
+		attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	}
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#else
+static int counter_open(int counter)
+{
+	return -1;
+}
+#endif
+
+static void mark(thread_stats_t *ts)
+{
+	int c;
+	for (c = 0; c != COUNTERS; ++c)
+		if (ts->fds[c] < 0 ||
+		    read(ts->fds[c], &ts->mark[c], sizeof(uint64_t)) !=
+		    sizeof(uint64_t))
+			ts->mark[c] = 0;
+	ts->mark_ns = now_ns();
+}
+
+void stats_start(q4112_stats_t *stats, int thread)
+{
+	thread_stats_t *ts = &stats->thread[thread];
+	int c;
+	for (c = 0; c != COUNTERS; ++c) {
+		ts->fds[c] = counter_open(c);
+		ts->available[c] = ts->fds[c] >= 0;
+	}
+	mark(ts);
+}
+
+void stats_phase(q4112_stats_t *stats, int thread, int phase)
+{
+	thread_stats_t *ts = &stats->thread[thread];
+	uint64_t beg_ns = ts->mark_ns;
+	uint64_t beg[COUNTERS];
+	int c;
+	memcpy(beg, ts->mark, sizeof(beg));
+	mark(ts);
+	ts->busy_ns[phase] += ts->mark_ns - beg_ns;
+	for (c = 0; c != COUNTERS; ++c)
+		ts->counters[phase][c] += ts->mark[c] - beg[c];
+}
+
+void stats_wait(q4112_stats_t *stats, int thread, int phase)
+{
+	thread_stats_t *ts = &stats->thread[thread];
+	uint64_t beg_ns = ts->mark_ns;
+	mark(ts);
+	ts->wait_ns[phase] += ts->mark_ns - beg_ns;
+}
+
+void stats_stop(q4112_stats_t *stats, int thread)
+{
+	thread_stats_t *ts = &stats->thread[thread];
+	int c;
+	for (c = 0; c != COUNTERS; ++c)
+		if (ts->fds[c] >= 0)
+			close(ts->fds[c]);
+}
+
+void stats_report(const q4112_stats_t *stats, const char *name)
+{
+	int t, p, c;
+	for (t = 0; t != stats->threads; ++t) {
+		const thread_stats_t *ts = &stats->thread[t];
+		for (p = 0; p != PHASES; ++p) {
+			fprintf(stderr, "%s thread %2d %-8s busy %12llu ns "
+				"wait %12llu ns", name, t, phase_names[p],
+				(unsigned long long) ts->busy_ns[p],
+				(unsigned long long) ts->wait_ns[p]);
+			for (c = 0; c != COUNTERS; ++c)
+				if (ts->available[c])
+					fprintf(stderr, " %s %llu",
+						counter_names[c],
+						(unsigned long long)
+						ts->counters[p][c]);
+			fprintf(stderr, "\n");
+		}
+	}
+}
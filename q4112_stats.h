@@ -0,0 +1,82 @@
+#ifndef _Q4112_STATS_
+#define _Q4112_STATS_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* phases of the hash join, separated by barriers */
+enum {
+	PHASE_BUILD,
+	PHASE_ESTIMATE,
+	PHASE_TABLE,
+	PHASE_PROBE,
+	PHASE_SCAN,
+	PHASES
+};
+
+/* hardware counters read with perf_event_open on Linux */
+enum {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_LLC_MISSES,
+	COUNTER_DTLB_MISSES,
+	COUNTER_BRANCH_MISSES,
+	COUNTERS
+};
+
+typedef struct {
+	/* time working in the phase and waiting at its closing barrier */
+	uint64_t busy_ns[PHASES];
+	uint64_t wait_ns[PHASES];
+	/* user space events while working in the phase */
+	uint64_t counters[PHASES][COUNTERS];
+	/* counters the kernel let us open (perf_event_paranoid, seccomp) */
+	int available[COUNTERS];
+	/* open counters and the readings at the last mark */
+	int fds[COUNTERS];
+	uint64_t mark_ns;
+	uint64_t mark[COUNTERS];
+} thread_stats_t;
+
+typedef struct {
+	int threads;
+	thread_stats_t *thread;
+} q4112_stats_t;
+
+const char *stats_phase_name(int phase);
+
+const char *stats_counter_name(int counter);
+
+void stats_init(q4112_stats_t *stats, int threads);
+
+void stats_free(q4112_stats_t *stats);
+
+/* open the counters of the calling worker thread and start a phase */
+void stats_start(q4112_stats_t *stats, int thread);
+
+/* account the time and events since the last mark to phase */
+void stats_phase(q4112_stats_t *stats, int thread, int phase);
+
+/* account the time since the last mark as barrier wait of phase */
+void stats_wait(q4112_stats_t *stats, int thread, int phase);
+
+/* close the counters of the calling worker thread */
+void stats_stop(q4112_stats_t *stats, int thread);
+
+/* print every thread and phase to stderr */
+void stats_report(const q4112_stats_t *stats, const char *name);
+
+/*
+ * the hash join of q4112_run with per thread, per phase statistics; the
+ * caller releases them with stats_free
+ */
+uint64_t q4112_run_stats(const uint32_t *inner_keys,
+			 const uint32_t *inner_vals,
+			 size_t inner_tuples,
+			 const uint32_t *outer_join_keys,
+			 const uint32_t *outer_aggr_keys,
+			 const uint32_t *outer_vals,
+			 size_t outer_tuples, int threads,
+			 q4112_stats_t *stats);
+
+#endif
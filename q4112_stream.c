@@ -0,0 +1,233 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "q4112_aggr.h"
+#include "q4112_pool.h"
+#include "q4112_probe.h"
+#include "q4112_stream.h"
+
+/* outer tuples probed per call of the probe kernel */
+#define PROBE_BLOCK 1024
+/* batches smaller than this run on the caller, not on the pool */
+#define MIN_PARALLEL_BATCH 65536
+/* initial group table of every thread; it grows when needed */
+#define LOG_GROUP_BUCKETS 10
+
+struct q4112_stream {
+	int threads;
+	int grouped;
+	q4112_pool_t *pool;
+	bucket_t *table;
+	int8_t log_buckets;
+	size_t buckets;
+	/* aggregation state of every thread */
+	aggr_table_t *groups;
+	aggr_sum_t *sums;
+	uint64_t *counts;
+	uint64_t tuples;
+	/* arguments of the running pool task */
+	const uint32_t *inner_keys;
+	const uint32_t *inner_vals;
+	const uint32_t *outer_keys;
+	const uint32_t *outer_aggr_keys;
+	const uint32_t *outer_vals;
+	morsel_cursor_t cursor;
+};
+
+static void build_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	q4112_stream_t *stream = (q4112_stream_t *) arg;
+	bucket_t *table = stream->table;
+	size_t i, h, beg, end;
+	while (morsel_next(&stream->cursor, &beg, &end)) {
+		for (i = beg; i != end; ++i) {
+			uint32_t key = stream->inner_keys[i];
+			h = (uint32_t) (key * BIG_NUMBER);
+			h >>= 32 - stream->log_buckets;
+			while (!__sync_bool_compare_and_swap(&table[h].key,
+							     0, key))
+				h = (h + 1) & (stream->buckets - 1);
+			table[h].val = stream->inner_vals[i];
+		}
+	}
+}
+
+/* join [beg, end) of the current batch into the state of thread */
+static void push_range(q4112_stream_t *stream, int thread,
+		       size_t beg, size_t end)
+{
+	const probe_kernel_t *probe = probe_kernel();
+	uint32_t sel[PROBE_BLOCK];
+	uint32_t vals[PROBE_BLOCK];
+	size_t o, m, matches;
+	for (o = beg; o < end; o += PROBE_BLOCK) {
+		size_t n = end - o < PROBE_BLOCK ? end - o : PROBE_BLOCK;
+		if (!stream->grouped) {
+			probe->sum(stream->table, stream->log_buckets,
+				   &stream->outer_keys[o],
+				   &stream->outer_vals[o], n,
+				   &stream->sums[thread],
+				   &stream->counts[thread]);
+			continue;
+		}
+		matches = probe->block(stream->table, stream->log_buckets,
+				       &stream->outer_keys[o], n, sel, vals);
+		for (m = 0; m != matches; ++m) {
+			size_t p = o + sel[m];
+			aggr_table_update(&stream->groups[thread],
+					  stream->outer_aggr_keys[p], 1,
+					  vals[m] * (uint64_t)
+					  stream->outer_vals[p]);
+		}
+	}
+}
+
+static void push_thread(q4112_pool_t *pool, int thread, void *arg)
+{
+	q4112_stream_t *stream = (q4112_stream_t *) arg;
+	size_t beg, end;
+	while (morsel_next(&stream->cursor, &beg, &end))
+		push_range(stream, thread, beg, end);
+}
+
+q4112_stream_t *stream_create(const uint32_t *inner_keys,
+			      const uint32_t *inner_vals,
+			      size_t inner_tuples, int grouped, int threads)
+{
+	int t, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(max_threads > 0 && threads > 0 && threads <= max_threads);
+	q4112_stream_t *stream = (q4112_stream_t *)
+		calloc(1, sizeof(q4112_stream_t));
+	assert(stream != NULL);
+	stream->threads = threads;
+	stream->grouped = grouped;
+	stream->pool = pool_create(threads);
+
+	/*same table as the hash join: 2^k buckets, fill rate up to 2/3*/
+	stream->log_buckets = 1;
+	stream->buckets = 2;
+	while (stream->buckets * 0.67 < inner_tuples) {
+		stream->log_buckets += 1;
+		stream->buckets += stream->buckets;
+	}
+	stream->table = (bucket_t *)
+		calloc(stream->buckets, sizeof(bucket_t));
+	assert(stream->table != NULL);
+	stream->inner_keys = inner_keys;
+	stream->inner_vals = inner_vals;
+	morsel_init(&stream->cursor, 0, inner_tuples);
+	pool_run(stream->pool, build_thread, stream);
+	stream->inner_keys = NULL;
+	stream->inner_vals = NULL;
+
+	stream->groups = (aggr_table_t *)
+		calloc(threads, sizeof(aggr_table_t));
+	stream->sums = (aggr_sum_t *) calloc(threads, sizeof(aggr_sum_t));
+	stream->counts = (uint64_t *) calloc(threads, sizeof(uint64_t));
+	assert(stream->groups != NULL);
+	assert(stream->sums != NULL && stream->counts != NULL);
+	if (grouped)
+		for (t = 0; t != threads; ++t)
+			aggr_table_init(&stream->groups[t],
+					LOG_GROUP_BUCKETS);
+	return stream;
+}
+
+void stream_destroy(q4112_stream_t *stream)
+{
+	int t;
+	if (stream->grouped)
+		for (t = 0; t != stream->threads; ++t)
+			aggr_table_free(&stream->groups[t]);
+	pool_destroy(stream->pool);
+	free(stream->groups);
+	free(stream->sums);
+	free(stream->counts);
+	free(stream->table);
+	free(stream);
+}
+
+void stream_push(q4112_stream_t *stream, const uint32_t *outer_join_keys,
+		 const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		 size_t outer_tuples)
+{
+	assert((outer_aggr_keys != NULL) == stream->grouped);
+	stream->outer_keys = outer_join_keys;
+	stream->outer_aggr_keys = outer_aggr_keys;
+	stream->outer_vals = outer_vals;
+	if (stream->threads == 1 || outer_tuples < MIN_PARALLEL_BATCH) {
+		push_range(stream, 0, 0, outer_tuples);
+	} else {
+		morsel_init(&stream->cursor, 0, outer_tuples);
+		pool_run(stream->pool, push_thread, stream);
+	}
+	stream->tuples += outer_tuples;
+}
+
+/* merge the group tables of all threads into one */
+static void merge_groups(q4112_stream_t *stream, aggr_table_t *merged)
+{
+	size_t i, used = 0;
+	int t;
+	for (t = 0; t != stream->threads; ++t)
+		used += stream->groups[t].used;
+	int8_t log_buckets = LOG_GROUP_BUCKETS;
+	while ((((size_t) 1) << log_buckets) * 0.67 < used)
+		log_buckets++;
+	aggr_table_init(merged, log_buckets);
+	for (t = 0; t != stream->threads; ++t) {
+		const aggr_table_t *groups = &stream->groups[t];
+		for (i = 0; i != groups->buckets; ++i)
+			if (groups->table[i].aggr_key != 0)
+				aggr_table_update(merged,
+						  groups->table[i].aggr_key,
+						  groups->table[i].count,
+						  aggr_bucket_sum(&groups->table[i]));
+	}
+}
+
+uint64_t stream_result(q4112_stream_t *stream)
+{
+	aggr_sum_t sum = 0;
+	uint64_t count = 0;
+	size_t i;
+	int t;
+	if (!stream->grouped) {
+		for (t = 0; t != stream->threads; ++t) {
+			sum += stream->sums[t];
+			count += stream->counts[t];
+		}
+		return count ? (uint64_t) (sum / count) : 0;
+	}
+	aggr_table_t merged;
+	merge_groups(stream, &merged);
+	for (i = 0; i != merged.buckets; ++i) {
+		if (merged.table[i].aggr_key != 0 &&
+		    merged.table[i].count > 0) {
+			sum += aggr_bucket_sum(&merged.table[i]) /
+				merged.table[i].count;
+			count += 1;
+		}
+	}
+	aggr_table_free(&merged);
+	return count ? (uint64_t) (sum / count) : 0;
+}
+
+uint64_t stream_tuples(const q4112_stream_t *stream)
+{
+	return stream->tuples;
+}
+
+size_t stream_groups(q4112_stream_t *stream)
+{
+	if (!stream->grouped)
+		return 0;
+	aggr_table_t merged;
+	merge_groups(stream, &merged);
+	size_t groups = merged.used;
+	aggr_table_free(&merged);
+	return groups;
+}
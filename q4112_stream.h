@@ -0,0 +1,45 @@
+#ifndef _Q4112_STREAM_
+#define _Q4112_STREAM_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * streaming execution of the query: the items table is hashed once, then
+ * orders arrive in batches of any size and are joined and aggregated
+ * into per thread group tables; memory is bounded by the items table
+ * and the groups, not by the orders seen so far
+ */
+typedef struct q4112_stream q4112_stream_t;
+
+/*
+ * build the items table on a pool of threads; grouped is zero for the
+ * global average (no orders.store_id)
+ */
+q4112_stream_t *stream_create(const uint32_t *inner_keys,
+			      const uint32_t *inner_vals,
+			      size_t inner_tuples, int grouped, int threads);
+
+void stream_destroy(q4112_stream_t *stream);
+
+/*
+ * join and aggregate a batch of orders; outer_aggr_keys must be NULL
+ * exactly if the stream is not grouped; batches are independent and the
+ * arrays can be reused once the call returns
+ */
+void stream_push(q4112_stream_t *stream, const uint32_t *outer_join_keys,
+		 const uint32_t *outer_aggr_keys, const uint32_t *outer_vals,
+		 size_t outer_tuples);
+
+/*
+ * result of q4112_run over all orders pushed so far; the stream stays
+ * open for more batches
+ */
+uint64_t stream_result(q4112_stream_t *stream);
+
+/* orders and groups seen so far */
+uint64_t stream_tuples(const q4112_stream_t *stream);
+
+size_t stream_groups(q4112_stream_t *stream);
+
+#endif
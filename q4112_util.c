@@ -0,0 +1,44 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "q4112_util.h"
+
+uint64_t real_time(void) {
+  struct timespec t;
+  // outside the assert so that it still runs with NDEBUG
+  int ret = clock_gettime(CLOCK_REALTIME, &t);
+  assert(ret == 0);
+  (void) ret;
+  return t.tv_sec * 1000ull * 1000 * 1000 + t.tv_nsec;
+}
+
+const char* add_commas(uint64_t x) {
+  static char buf[32];
+  int digit = 0;
+  size_t i = sizeof(buf) / sizeof(char);
+  buf[--i] = '\0';
+  do {
+    if (digit++ == 3) {
+      buf[--i] = ',';
+      digit = 1;
+    }
+    buf[--i] = (x % 10) + '0';
+    x /= 10;
+  } while (x);
+  return &buf[i];
+}
+
+uint32_t* alloc_column(size_t tuples, const char* name) {
+  uint32_t* column = NULL;
+  if (tuples <= SIZE_MAX / sizeof(uint32_t))
+    column = (uint32_t*) malloc(tuples * sizeof(uint32_t));
+  if (column == NULL) {
+    fprintf(stderr, "Cannot allocate %s: %s tuples\n", name,
+            add_commas(tuples));
+    exit(EXIT_FAILURE);
+  }
+  return column;
+}
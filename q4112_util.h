@@ -0,0 +1,19 @@
+#ifndef _Q4112_UTIL_
+#define _Q4112_UTIL_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// helpers shared by the command line drivers
+
+// wall clock time in nanoseconds
+uint64_t real_time(void);
+
+// number with thousands separators (in a static buffer)
+const char* add_commas(uint64_t x);
+
+// allocate a column of 32-bit values and exit if that is not possible,
+// billions of tuples may not fit in memory (or in size_t bytes)
+uint32_t* alloc_column(size_t tuples, const char* name);
+
+#endif